@@ -0,0 +1,376 @@
+// Benchmarks of the editor's hot paths, driven through a headless Editor.
+//
+//   kilo++_bench [--benchmark_...] [FILE...]
+//
+// Every benchmark taking a corpus runs on a generated C file and on each
+// FILE given.
+
+#include "kilo++/Editor.hpp"
+#include "kilo++/EditorUtils.hpp"
+#include "kilo++/Regex.hpp"
+#include "kilo++/Terminal.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+/*** defines ***/
+
+#define BENCH_SCREEN_ROWS 50
+#define BENCH_SCREEN_COLS 160
+#define BENCH_SYNTHETIC_ROWS 200000
+// rows the row insertion and deletion benchmarks work on
+#define BENCH_EDIT_ROWS 100000
+
+namespace
+{
+  struct Corpus
+  {
+    std::string name;
+    std::string path;
+  };
+
+  std::vector<Corpus> corpora;
+  std::filesystem::path scratch;
+
+  /*** corpora ***/
+
+  // C-like source mixing keywords, comments, strings, numbers and tabs in
+  // roughly the proportions of real code.
+  std::string syntheticLine(std::mt19937 &rng)
+  {
+    static const char *const lines[] = {
+        "int main(int argc, char *argv[])",
+        "{",
+        "\tfor (unsigned i = 0; i < count; ++i)",
+        "\t\tif (table[i].flags & 0x40 && table[i].size > 1024)",
+        "\t\t\treturn lookup(table, \"needle\", 3.25);",
+        "\t/* walk the list and free every node */",
+        "    while (node != NULL) { struct entry *next = node->next; free(node); node = next; }",
+        "// TODO: this should not be quadratic",
+        "static const char *names[] = {\"alpha\", \"beta\", \"gamma\", \"delta\"};",
+        "\tswitch (kind) { case 1: break; case 2: continue; default: return -1; }",
+        "}",
+        "",
+        "/*",
+        " * Multi-line comments span several rows, which is what makes",
+        " * highlighting depend on the rows above.",
+        " */",
+        "typedef struct { double x, y; long id; char tag[16]; } point_t;",
+    };
+
+    return lines[rng() % (sizeof(lines) / sizeof(lines[0]))];
+  }
+
+  std::string writeSynthetic(std::size_t rows)
+  {
+    const auto path = (scratch / ("synthetic-" + std::to_string(rows) + ".c")).string();
+    std::ofstream out(path);
+    std::mt19937 rng(42);
+    for (std::size_t i = 0; i < rows; ++i)
+      out << syntheticLine(rng) << '\n';
+    return path;
+  }
+
+  std::unique_ptr<Editor> headlessEditor()
+  {
+    return std::make_unique<Editor>(std::make_unique<HeadlessTerminal>(BENCH_SCREEN_ROWS + 2, BENCH_SCREEN_COLS));
+  }
+
+  std::unique_ptr<Editor> openCorpus(const Corpus &corpus)
+  {
+    auto editor = headlessEditor();
+    editor->open(corpus.path.c_str());
+    return editor;
+  }
+
+  // Highlights every row, as if the whole file had been scrolled through.
+  void highlightAll(Editor &editor)
+  {
+    auto &buf = editor.currentBuffer();
+    bool in_comment = false;
+    for (std::size_t y = 0; y < buf.rows.size(); ++y)
+    {
+      auto &erow = buf.rows[y];
+      editor.updateSyntax(erow, in_comment);
+      in_comment = erow.hl_open_comment;
+    }
+    buf.hl_stale_from = static_cast<int>(buf.rows.size());
+  }
+
+  /*** benchmarks ***/
+
+  void BM_Open(benchmark::State &state, const Corpus &corpus)
+  {
+    auto editor = headlessEditor();
+    std::size_t rows = 0;
+    for (auto _ : state)
+    {
+      editor->open(corpus.path.c_str());
+      rows = editor->currentBuffer().rows.size();
+    }
+    state.counters["rows"] = static_cast<double>(rows);
+    state.SetBytesProcessed(state.iterations() * std::filesystem::file_size(corpus.path));
+  }
+
+  void BM_UpdateSyntax(benchmark::State &state, const Corpus &corpus)
+  {
+    auto editor = openCorpus(corpus);
+    auto &buf = editor->currentBuffer();
+
+    std::size_t bytes = 0;
+    for (std::size_t y = 0; y < buf.rows.size(); ++y)
+      bytes += buf.rows[y].row.size();
+
+    for (auto _ : state)
+      highlightAll(*editor);
+
+    state.SetBytesProcessed(state.iterations() * bytes);
+    state.SetItemsProcessed(state.iterations() * buf.rows.size());
+  }
+
+  // One incremental search typed key by key, as findCallback() sees it from
+  // the prompt; each key is one item.
+  void BM_FindIncremental(benchmark::State &state, const Corpus &corpus, const char *needle)
+  {
+    auto editor = openCorpus(corpus);
+    const std::string word(needle);
+    std::string query;
+
+    for (auto _ : state)
+    {
+      for (std::size_t n = 1; n <= word.size(); ++n)
+      {
+        query.assign(word, 0, n);
+        editor->findCallback(query, word[n - 1]);
+      }
+      editor->findCallback(query, '\x1b');
+    }
+
+    state.SetItemsProcessed(state.iterations() * word.size());
+  }
+
+  // Stepping to the next match of a search already run.
+  void BM_FindNext(benchmark::State &state, const Corpus &corpus, const char *needle)
+  {
+    auto editor = openCorpus(corpus);
+    std::string query(needle);
+    editor->findCallback(query, query.back());
+
+    for (auto _ : state)
+      editor->findCallback(query, static_cast<int>(EditorKey::ARROW_DOWN));
+
+    editor->findCallback(query, '\x1b');
+  }
+
+  // Every match of a pattern whose longer alternative never dies on a line
+  // of state.range(0) repetitions of "ab", where every 'a' starts a match;
+  // the time should grow with the line, not with its square.
+  void BM_RegexLongLine(benchmark::State &state)
+  {
+    std::string error;
+    const auto regex = Regex::compile("ab|a.*c", error);
+    RegexMatcher matcher(*regex);
+
+    std::string line;
+    for (int64_t i = 0; i < state.range(0); ++i)
+      line += "ab";
+
+    for (auto _ : state)
+    {
+      std::size_t matches = 0;
+      matcher.forEachMatch(line, [&](std::size_t, std::size_t)
+                           { matches++; });
+      benchmark::DoNotOptimize(matches);
+    }
+
+    state.SetBytesProcessed(state.iterations() * line.size());
+  }
+
+  // Composing the text area while paging through highlighted rows.
+  void BM_DrawRows(benchmark::State &state, const Corpus &corpus)
+  {
+    auto editor = openCorpus(corpus);
+    auto &buf = editor->currentBuffer();
+    highlightAll(*editor);
+
+    std::vector<std::string> frame(BENCH_SCREEN_ROWS);
+    for (auto &line : frame)
+      line.reserve(BENCH_SCREEN_COLS * 20 + 32);
+
+    const int pages = std::max<int>(1, static_cast<int>(buf.rows.size()) / BENCH_SCREEN_ROWS);
+    int page = 0;
+    std::size_t bytes = 0;
+    for (auto _ : state)
+    {
+      buf.rowoff = page * BENCH_SCREEN_ROWS;
+      page = (page + 1) % pages;
+
+      editor->drawRows(frame);
+      for (const auto &line : frame)
+        bytes += line.size();
+    }
+
+    state.SetBytesProcessed(bytes);
+    state.counters["bytes_per_frame"] = benchmark::Counter(static_cast<double>(bytes) / state.iterations());
+  }
+
+  // Row insertion and deletion in an unnamed buffer of BENCH_EDIT_ROWS rows,
+  // at the front, the middle or the end; undo history is recorded as in a
+  // real edit.
+  int editPosition(std::size_t rows, int64_t where)
+  {
+    return where == 0 ? 0 : where == 1 ? static_cast<int>(rows / 2) : static_cast<int>(rows);
+  }
+
+  void fillRows(Editor &editor, std::size_t rows)
+  {
+    std::mt19937 rng(7);
+    auto &buf = editor.currentBuffer();
+    while (buf.rows.size() < rows)
+      editor.insertRow(static_cast<int>(buf.rows.size()), syntheticLine(rng));
+  }
+
+  void BM_InsertRow(benchmark::State &state, int64_t where)
+  {
+    auto editor = headlessEditor();
+    fillRows(*editor, BENCH_EDIT_ROWS);
+    auto &buf = editor->currentBuffer();
+    const std::string line = "\tif (table[i].flags & 0x40) return lookup(table, \"needle\", 3.25);";
+
+    for (auto _ : state)
+      editor->insertRow(editPosition(buf.rows.size(), where), line);
+  }
+
+  void BM_DeleteRow(benchmark::State &state, int64_t where)
+  {
+    auto editor = headlessEditor();
+    fillRows(*editor, BENCH_EDIT_ROWS);
+    auto &buf = editor->currentBuffer();
+
+    for (auto _ : state)
+    {
+      if (buf.rows.size() < BENCH_EDIT_ROWS / 2)
+      {
+        state.PauseTiming();
+        fillRows(*editor, BENCH_EDIT_ROWS);
+        state.ResumeTiming();
+      }
+
+      const auto rows = buf.rows.size();
+      editor->deleteRow(std::min(editPosition(rows, where), static_cast<int>(rows) - 1));
+    }
+  }
+
+  std::string readAll(const std::string &path)
+  {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+
+  // Saves an edit near the top of a file with a second hard link, which is
+  // written in place rather than renamed over, and checks the other name
+  // sees exactly the edited text.
+  void BM_SaveHardLinked(benchmark::State &state, const Corpus &corpus)
+  {
+    const std::string keys(100, 'x');
+    const std::string original = readAll(corpus.path);
+    const std::string expected = keys + original;
+    const auto path = (scratch / "linked.c").string();
+    const auto alias = (scratch / "linked-alias.c").string();
+    std::filesystem::remove(alias);
+    std::ofstream(path, std::ios::binary) << original;
+    std::filesystem::create_hard_link(path, alias);
+
+    for (auto _ : state)
+    {
+      state.PauseTiming();
+      std::ofstream(path, std::ios::binary | std::ios::trunc) << original;
+      auto terminal = std::make_unique<HeadlessTerminal>(BENCH_SCREEN_ROWS + 2, BENCH_SCREEN_COLS);
+      terminal->pushInput(keys);
+      Editor editor(std::move(terminal));
+      state.ResumeTiming();
+
+      std::string error;
+      if (!editor.runScript(path, error))
+      {
+        state.SkipWithError(error.c_str());
+        break;
+      }
+
+      state.PauseTiming();
+      const bool saved = readAll(alias) == expected;
+      state.ResumeTiming();
+      if (!saved)
+      {
+        state.SkipWithError("hard-linked save does not match the edited text");
+        break;
+      }
+    }
+  }
+
+  const char *positionName(int64_t where)
+  {
+    return where == 0 ? "front" : where == 1 ? "middle" : "back";
+  }
+}
+
+int main(int argc, char **argv)
+{
+  benchmark::Initialize(&argc, argv);
+
+  std::error_code ec;
+  char dir[] = "/tmp/kilo-bench-XXXXXX";
+  if (!mkdtemp(dir))
+  {
+    std::perror("mkdtemp");
+    return 1;
+  }
+  scratch = dir;
+
+  corpora.push_back({"synthetic", writeSynthetic(BENCH_SYNTHETIC_ROWS)});
+  for (int i = 1; i < argc; ++i)
+    corpora.push_back({std::filesystem::path(argv[i]).filename().string(), argv[i]});
+
+  for (const auto &corpus : corpora)
+  {
+    benchmark::RegisterBenchmark(("BM_Open/" + corpus.name).c_str(), BM_Open, corpus)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("BM_UpdateSyntax/" + corpus.name).c_str(), BM_UpdateSyntax, corpus)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("BM_FindIncremental/" + corpus.name).c_str(), BM_FindIncremental, corpus, "return")
+        ->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark(("BM_FindNext/" + corpus.name).c_str(), BM_FindNext, corpus, "return");
+    benchmark::RegisterBenchmark(("BM_DrawRows/" + corpus.name).c_str(), BM_DrawRows, corpus)
+        ->Unit(benchmark::kMicrosecond);
+  }
+
+  benchmark::RegisterBenchmark("BM_SaveHardLinked", BM_SaveHardLinked, corpora.front())
+      ->Unit(benchmark::kMillisecond);
+
+  benchmark::RegisterBenchmark("BM_RegexLongLine", BM_RegexLongLine)
+      ->Arg(10000)
+      ->Arg(40000)
+      ->Unit(benchmark::kMillisecond);
+
+  for (int64_t where = 0; where < 3; ++where)
+  {
+    benchmark::RegisterBenchmark((std::string("BM_InsertRow/") + positionName(where)).c_str(), BM_InsertRow, where);
+    benchmark::RegisterBenchmark((std::string("BM_DeleteRow/") + positionName(where)).c_str(), BM_DeleteRow, where);
+  }
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+
+  std::filesystem::remove_all(scratch, ec);
+  return 0;
+}
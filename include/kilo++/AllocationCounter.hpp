@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+/*** allocation counter ***/
+
+// Debug builds replace the global operator new to count the heap
+// allocations each thread makes, so code meant to run without allocating
+// can be checked. With NDEBUG the standard allocator stays in place and the
+// count is always 0.
+namespace allocation_counter
+{
+  std::size_t count();
+}
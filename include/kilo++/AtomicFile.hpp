@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <sys/uio.h>
+#include <vector>
+
+/*** atomic file ***/
+
+// Writes a new version of a file under a temporary name in the same
+// directory and renames it over the original once it is safely on disk, so
+// the old contents stay intact until the switch and a crash never leaves a
+// torn file behind. A symlink is followed and the file it points to is the
+// one replaced. Where a rename would lose something, the file is instead
+// overwritten in place: when it has other hard links, when its directory
+// takes no new files, or when its owner can't be given to the replacement.
+// Pieces passed to append() are gathered into writev() batches without
+// being copied, so they must stay valid until commit(). Every call
+// returning false leaves the reason in errno.
+class AtomicFile
+{
+public:
+  explicit AtomicFile(std::string path);
+
+  // Removes the temporary file unless commit() succeeded.
+  ~AtomicFile();
+
+  AtomicFile(const AtomicFile &) = delete;
+  AtomicFile &operator=(const AtomicFile &) = delete;
+
+  bool open();
+
+  // Whether open() fell back to overwriting the file in place. Pieces are
+  // then written over it as they come, so none may point into a mapping
+  // of it.
+  bool inPlace() const;
+
+  bool append(std::string_view data);
+
+  // Flushes, syncs and renames the file into place, keeping the original's
+  // permissions and owner.
+  bool commit();
+
+  std::size_t bytesWritten() const;
+
+private:
+  bool flush();
+
+  bool openInPlace();
+
+  std::string m_path;
+  // m_path with symlinks resolved
+  std::string m_target;
+  std::string m_tmp_path;
+  bool m_in_place = false;
+  int m_fd = -1;
+  std::vector<iovec> m_iov;
+  std::size_t m_bytes = 0;
+  bool m_committed = false;
+};
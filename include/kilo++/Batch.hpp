@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*** batch ***/
+
+// Replays the keystrokes recorded in the file `script` against each of
+// `files` in a headless editor of its own and saves the results, working
+// on several files at a time on the shared thread pool. The script holds
+// the bytes a terminal would send, escape sequences and bracketed pastes
+// included. A file named more than once, under any path, is edited once.
+// Failures are reported on `err`, in the order of the files.
+// Returns how many files failed.
+std::size_t runBatch(const std::string &script, const std::vector<std::string> &files, std::ostream &err);
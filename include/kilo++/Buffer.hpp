@@ -0,0 +1,48 @@
+#pragma once
+
+#include "kilo++/Journal.hpp"
+#include "kilo++/RowBuffer.hpp"
+#include "kilo++/Syntax.hpp"
+#include "kilo++/UndoLog.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*** buffer ***/
+
+// One open file: its rows, the view and cursor on it and the state tied to
+// its contents. Syntax definitions are shared between buffers, and
+// everything that draws, searches or highlights in the background belongs
+// to the Editor.
+struct Buffer
+{
+  explicit Buffer(std::size_t undo_limit) : undo(undo_limit) {}
+
+  RowBuffer rows;
+  std::string filename;
+  int cx = 0, cy = 0;
+  int rowoff = 0, coloff = 0;
+  // screen lines of row rowoff scrolled off the top while wrapping
+  int wrapoff = 0;
+  int dirty = 0;
+  std::shared_ptr<const EditorSyntax> syntax;
+  int hl_stale_from = 0;
+  // changes with every edit and is unique across buffers, so results
+  // keyed by it never get applied to the wrong one
+  uint64_t version = 0;
+  uint64_t hl_job_version = 0;
+  int hl_job_row = -1;
+  // whether each row ends inside a multi-line comment, known for rows
+  // before hl_index_valid; lets a jump far past hl_stale_from highlight
+  // just the rows on screen
+  std::vector<uint8_t> hl_comment_index;
+  int hl_index_valid = 0;
+  // rows highlighted that way for the current version
+  int hl_window_first = 0, hl_window_last = -1;
+  uint64_t hl_window_version = 0;
+  UndoLog undo;
+  Journal journal;
+};
@@ -1,5 +1,18 @@
 #pragma once
 
+#include "kilo++/Buffer.hpp"
+#include "kilo++/EditorRow.hpp"
+#include "kilo++/FileSource.hpp"
+#include "kilo++/FileWatcher.hpp"
+#include "kilo++/Profiler.hpp"
+#include "kilo++/Search.hpp"
+#include "kilo++/Syntax.hpp"
+#include "kilo++/SyntaxWorker.hpp"
+#include "kilo++/Terminal.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
 #include <functional>
 #include <memory>
 #include <string>
@@ -7,57 +20,68 @@
 #include <time.h>
 #include <vector>
 
-/*** data **/
-
-enum class EditorHighlight : unsigned char
-{
-  NORMAL = 0,
-  COMMENT,
-  ML_COMMENT,
-  KEYWORD1,
-  KEYWORD2,
-  STRING,
-  NUMBER,
-  MATCH
-};
-
-struct EditorSyntax
-{
-  std::string filetype;
-  std::vector<std::string_view> filematch;
-  std::vector<std::string_view> keywords;
-  std::string singleline_comment_start;
-  std::string multiline_comment_start;
-  std::string multiline_comment_end;
-  int32_t flags;
-};
-
-struct EditorRow
-{
-  EditorRow(int index) : idx(index), row({}), rendered({}), hl({})
-  {
-    hl_open_comment = false;
-  };
-
-  int idx;
-  std::string row;
-  std::string rendered;
-  std::vector<EditorHighlight> hl;
-  bool hl_open_comment;
-};
-
 /*** class definition */
 
 class Editor
 {
 public:
+  // An editor on the controlling terminal.
   Editor();
 
+  explicit Editor(std::unique_ptr<Terminal> terminal);
+
+  // Edits the files named until the user quits.
   void run(int argc, char *argv[]);
 
+  // Shows `filename` read-only until the user quits, straight from its
+  // mapping: only the rows on screen are built and highlighted. With
+  // `follow`, lines appended to the file show up as they are written.
+  void view(const std::string &filename, bool follow);
+
+  // Opens `filename` and applies the keys queued on the terminal as if they
+  // were typed one at a time, without drawing anything, then saves every
+  // named buffer left modified. Swap files are neither read nor written.
+  // Returns false with the reason in `error` if a buffer could not be
+  // saved; a script that runs out of keys inside a prompt throws.
+  bool runScript(const std::string &filename, std::string &error);
+
+  /*** buffers ***/
+
+  std::size_t addBuffer();
+
+  void switchBuffer(std::size_t index);
+
+  void openBuffer(const std::string &filename);
+
+  void closeBuffer();
+
+  bool anyBufferDirty() const;
+
+  Buffer &currentBuffer();
+
+  /*** memory ***/
+
+  std::size_t memoryInUse() const;
+
+  void enforceMemoryBudget();
+
+  void showMemoryUsage();
+
   /*** syntax highlighting ***/
 
-  void updateSyntax(EditorRow &erow);
+  void updateSyntax(EditorRow &erow, bool in_comment);
+
+  void invalidateSyntax(int yindex);
+
+  void ensureSyntax(int last);
+
+  void scheduleSyntax(int first, int last, bool in_comment);
+
+  void indexCommentStates(int target);
+
+  void highlightWindow(int first, int last);
+
+  bool applySyntaxResults();
 
   int convertSyntaxToColor(EditorHighlight hl);
 
@@ -69,17 +93,29 @@ public:
 
   int convertRowRxToCx(EditorRow &erow, int rx);
 
-  void updateRow(EditorRow &erow);
+  void indexTabs(EditorRow &erow);
+
+  void updateRow(int yindex);
+
+  void edit(UndoLog::Op op, int yindex, int xindex, std::string_view text);
+
+  void applyEdit(UndoLog::Op op, int yindex, int xindex, std::string_view text);
 
-  bool insertRow(int yindex, const std::string &s);
+  bool editFits(UndoLog::Op op, int yindex, int xindex, std::string_view text);
+
+  bool insertRow(int yindex, std::string_view s);
 
   void deleteRow(int yindex);
 
-  void insertCharIntoRow(EditorRow &erow, int yindex, int c);
+  void splitRow(int yindex, int xindex);
+
+  void joinRows(int yindex);
 
-  void appendStringToRow(EditorRow &erow, const std::string &s);
+  void insertCharIntoRow(int yindex, int xindex, int c);
 
-  void deleteCharFromRow(EditorRow &erow, int xindex);
+  void insertStringIntoRow(int yindex, int xindex, std::string_view s);
+
+  void deleteCharFromRow(int yindex, int xindex);
 
   /*** editor operations ***/
 
@@ -87,11 +123,15 @@ public:
 
   void insertNewline();
 
+  void insertText(std::string_view text);
+
   void deleteChar();
 
-  /*** file i/o ***/
+  void undo();
+
+  void redo();
 
-  std::string convertRowsToString();
+  /*** file i/o ***/
 
   void open(const char *filename);
 
@@ -103,16 +143,30 @@ public:
 
   void find();
 
+  int replaceMatches(const std::vector<SearchMatch> &matches, std::string_view with);
+
+  void replace();
+
   /*** output ***/
 
   void scroll();
 
-  void drawRows(std::string &s);
+  std::size_t screenTop() const;
+
+  void drawRows(std::vector<std::string> &frame);
+
+  void drawRow(std::string &s, int filerow, int coloff);
+
+  void prepareViewRows();
 
   void drawStatusBar(std::string &s);
 
   void drawMessageBar(std::string &s);
 
+  void scrollShadow(std::string &s);
+
+  void drawChangedLines(std::string &s);
+
   void refreshScreen();
 
   void setStatusMessage(const char *fmt, ...);
@@ -121,23 +175,101 @@ public:
 
   std::string fromPrompt(
       std::string prompt,
-      std::function<void(std::string &, int)> callback = nullptr);
+      std::function<void(std::string &, int)> callback = nullptr,
+      bool allow_empty = false);
+
+  bool pollEvents(int timeout_ms);
+
+  int nextTimeout() const;
+
+  void handleResize();
+
+  void waitForInput();
 
   void moveCursor(int key);
 
+  void pageWrapped(bool down);
+
   void processKeypress();
 
+  bool processViewKeypress(int c);
+
+  void followFile();
+
+  void startSession();
+
+  void loop();
+
 private:
   /*** members ***/
 
-  std::vector<EditorRow> m_rows;
-  int m_cx = 0, m_cy = 0;
+  // outlives everything below, so the screen is restored last
+  std::unique_ptr<Terminal> m_term;
+
+  // every open file, and the one shown
+  std::vector<std::unique_ptr<Buffer>> m_buffers;
+  std::size_t m_current = 0;
+  Buffer *m_buf = nullptr;
+  uint64_t m_next_version = 0;
+
   int m_rx = 0;
-  int m_rowoff = 0, m_coloff = 0;
+  // where on the screen the cursor is drawn
+  int m_screen_y = 0, m_screen_x = 0;
   int m_screenrows, m_screencols;
-  uint8_t m_dirty = 0;
-  std::string m_filename = "";
   std::string m_statusmsg = "\0";
   time_t m_statusmsg_time = 0;
-  std::shared_ptr<EditorSyntax> m_syntax = nullptr;
+  SyntaxWorker m_syntax_worker;
+  SearchIndex m_search;
+  SearchMatch m_search_origin = {0, 0, 0};
+  bool m_search_regex = false;
+  // the match the search prompt is on, drawn over the row's highlighting
+  SearchMatch m_search_hl = {-1, 0, 0};
+  std::string m_search_status;
+  bool m_search_has_match = false;
+  SearchMatch m_search_last = {0, 0, 0};
+  int m_search_direction = 1;
+
+  // presses of Ctrl-Q and Ctrl-W still needed to drop unsaved changes
+  int m_quit_times;
+  int m_close_times;
+
+  // screen lines being composed, and the lines the terminal currently shows
+  std::vector<std::string> m_frame;
+  std::vector<std::string> m_shadow;
+  std::size_t m_shadow_top = 0;
+  bool m_shadow_valid = false;
+
+  // bytes sent to the terminal by one refresh and the right half of the
+  // status bar; kept around so a steady-state frame allocates nothing
+  std::string m_out;
+  std::string m_status_right;
+  // escape sequence selecting the colour of each highlight class
+  std::array<std::string, HL_COUNT> m_sgr;
+  // heap allocations made drawing the last frame, counted in debug builds
+  std::size_t m_frame_allocations = 0;
+
+  // whether the screen is out of date, and when it was last drawn
+  bool m_redraw = true;
+  std::chrono::steady_clock::time_point m_last_frame;
+  bool m_quit = false;
+  // latency of the hot paths, collected while toggled on with Ctrl-T
+  Profiler m_profiler;
+  // replaying a script: nothing is drawn and no swap files are kept
+  bool m_batch = false;
+  // long rows continue on the next screen lines instead of scrolling sideways
+  bool m_wrap = false;
+
+  // viewing read-only, and the rows on screen built from the mapping
+  bool m_view = false;
+  std::vector<EditorRow> m_view_rows;
+  // following a growing file: its source and the watch on it
+  bool m_follow = false;
+  std::shared_ptr<FileSource> m_follow_source;
+  FileWatcher m_watcher;
+
+  // bytes the rows and undo logs of all buffers may take before the spans
+  // of rows far from view are dropped, 0 for no limit, and what was in use
+  // after the last time they were
+  std::size_t m_memory_budget = 0;
+  std::size_t m_evicted_at = 0;
 };
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*** data ***/
+
+enum class EditorHighlight : unsigned char
+{
+  NORMAL = 0,
+  COMMENT,
+  ML_COMMENT,
+  KEYWORD1,
+  KEYWORD2,
+  STRING,
+  NUMBER,
+  MATCH
+};
+
+#define HL_COUNT (static_cast<std::size_t>(EditorHighlight::MATCH) + 1)
+
+// A run of characters of the row sharing one highlight class. Rows keep
+// only the runs that are not NORMAL, sorted by start.
+struct HighlightSpan
+{
+  uint32_t start;
+  uint32_t len;
+  EditorHighlight hl;
+};
+
+// Rows stored in a RowBuffer allocate from its arena; the allocator-extended
+// constructors let the buffer move rows built elsewhere into it.
+struct EditorRow
+{
+  using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+  EditorRow() = default;
+
+  explicit EditorRow(const allocator_type &alloc)
+      : row(alloc), tabs(alloc), hl(alloc) {}
+
+  EditorRow(EditorRow &&other, const allocator_type &alloc)
+      : row(std::move(other.row), alloc),
+        tabs(std::move(other.tabs), alloc),
+        hl(std::move(other.hl), alloc),
+        hl_open_comment(other.hl_open_comment),
+        hl_start_comment(other.hl_start_comment),
+        hl_valid(other.hl_valid),
+        ascii(other.ascii) {}
+
+  std::pmr::string row;
+  // positions of the tabs in row, so rendered columns can be worked out
+  // without expanding it; empty for the usual tab-free row
+  std::pmr::vector<uint32_t> tabs;
+  std::pmr::vector<HighlightSpan> hl;
+  // hl is valid for the current text when it was computed starting from
+  // hl_start_comment and that still matches the previous row's
+  // hl_open_comment; the pair acts as a checkpoint for lazy highlighting
+  bool hl_open_comment = false;
+  bool hl_start_comment = false;
+  bool hl_valid = false;
+  // every byte is one column, so columns are worked out from tabs alone;
+  // other rows are laid out a UTF-8 character at a time
+  bool ascii = true;
+};
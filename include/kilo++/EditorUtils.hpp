@@ -1,5 +1,9 @@
 #pragma once
 
+#include <string>
+#include <string_view>
+#include <vector>
+
 enum class EditorKey
 {
   BACKSPACE = 127,
@@ -11,12 +15,14 @@ enum class EditorKey
   HOME_KEY,
   END_KEY,
   PAGE_UP,
-  PAGE_DOWN
+  PAGE_DOWN,
+  PASTE
 };
 
 namespace terminal_manager
 {
-  void die(const char *s);
+  // Throws std::system_error for the call `s` that failed with errno.
+  [[noreturn]] void die(const char *s);
 
   void disableRawMode();
 
@@ -24,5 +30,26 @@ namespace terminal_manager
 
   int getWindowSize(int *rows, int *cols);
 
+  // Decodes the next key from input read off the terminal in bulk,
+  // waiting for more if none is buffered. A bracketed paste comes back as a
+  // single EditorKey::PASTE with its text in pastedText().
   int readKey();
+
+  // Decodes input that has arrived in full into keys, as readKey() would
+  // have returned them; the text of each EditorKey::PASTE is appended to
+  // `pastes`.
+  void decodeInput(std::string_view input, std::vector<int> &keys, std::vector<std::string> &pastes);
+
+  // Whether input is already buffered, so readKey() will not block.
+  bool inputPending();
+
+  const std::string &pastedText();
+
+  // Read end of a pipe that becomes readable when the window is resized;
+  // the SIGWINCH handler is installed on the first call.
+  int resizeFd();
+
+  // Drains the resize pipe, returning whether a resize happened since the
+  // last call.
+  bool takeResize();
 }
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*** file source ***/
+
+// Read-only memory mapping of a file plus the offsets of its line starts.
+// Opening only scans for newlines; line contents are sliced out of the
+// mapping on demand.
+class FileSource
+{
+public:
+  // Returns nullptr and leaves errno set when the file cannot be mapped. A
+  // growable source keeps the file open so grow() can pick up appends.
+  static std::shared_ptr<FileSource> open(const std::string &path, bool growable = false);
+
+  ~FileSource();
+
+  FileSource(const FileSource &) = delete;
+  FileSource &operator=(const FileSource &) = delete;
+
+  std::size_t lineCount() const;
+
+  // Line contents without the trailing newline (and carriage returns).
+  std::string_view line(std::size_t index) const;
+
+  std::size_t bytes() const;
+
+  // Heap bytes of the line index.
+  std::size_t indexBytes() const;
+
+  // Maps and indexes whatever was appended to a growable source's file
+  // since it was opened or last grown; a last line without a newline may
+  // get longer. Returns false, leaving the source as it was, if the file
+  // got shorter or cannot be read.
+  bool grow();
+
+private:
+  FileSource() = default;
+
+  // Indexes the lines from byte `from` on, continuing the last line if
+  // `from` is in the middle of it.
+  void indexLines(std::size_t from);
+
+  const char *m_data = nullptr;
+  std::size_t m_size = 0;
+  std::vector<uint64_t> m_line_starts;
+  int m_fd = -1;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+
+/*** file watcher ***/
+
+// Tells when a file is written to, through an inotify descriptor the event
+// loop polls along with its input.
+class FileWatcher
+{
+public:
+  FileWatcher() = default;
+  ~FileWatcher();
+
+  FileWatcher(const FileWatcher &) = delete;
+  FileWatcher &operator=(const FileWatcher &) = delete;
+
+  // Starts watching `path`, replacing any file watched before. Returns
+  // false with errno set if it cannot be watched.
+  bool watch(const std::string &path);
+
+  void stop();
+
+  // Readable once the file has been written to; -1 while nothing is watched.
+  int fd() const;
+
+  // Whether the file was written to since the last call. Never blocks.
+  bool takeChanges();
+
+private:
+  int m_fd = -1;
+};
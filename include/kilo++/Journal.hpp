@@ -0,0 +1,94 @@
+#pragma once
+
+#include "kilo++/UndoLog.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+/*** journal ***/
+
+// Write-ahead swap file next to the file being edited, holding every edit
+// made since it was last saved, so a killed session can be replayed onto
+// the file on disk. append() only queues the edit; a background thread,
+// started by the first open(), writes and syncs whatever has queued up
+// every KILO_JOURNAL_FLUSH_MS, so an edit costs no I/O on the typing path
+// and at most that long of work is lost in a crash.
+class Journal
+{
+public:
+  using ApplyFn = std::function<bool(UndoLog::Op, int, int, std::string_view)>;
+
+  struct Recovery
+  {
+    // edits replayed from a swap file left behind
+    std::size_t edits = 0;
+    // a swap file was found for another version of the file and moved aside
+    bool stale = false;
+  };
+
+  Journal();
+
+  // Writes out what is still queued.
+  ~Journal();
+
+  Journal(const Journal &) = delete;
+  Journal &operator=(const Journal &) = delete;
+
+  // Starts journaling edits to the file at `path`. A swap file recorded
+  // against the same version of the file is replayed through
+  // apply(op, row, col, text) first, up to the first edit apply() rejects
+  // or the first damaged record, and journaling carries on after it.
+  Recovery open(const std::string &path, const ApplyFn &apply);
+
+  void append(UndoLog::Op op, int row, int col, std::string_view text);
+
+  // Forgets the journaled edits, for when the buffer has been saved over
+  // the file or thrown away.
+  void discard();
+
+  static std::string swapPath(const std::string &path);
+
+private:
+  struct Identity
+  {
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+  };
+
+  static bool identify(const std::string &path, Identity &identity);
+
+  void run();
+
+  bool write(const std::string &batch, uint64_t generation);
+
+  std::string m_path;
+  std::string m_swap_path;
+  Identity m_identity;
+  bool m_replaying = false;
+  std::atomic<bool> m_failed{false};
+
+  // guards the queue, generation and stop flag
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::string m_pending;
+  // bumped whenever the journaled edits are thrown away, so a batch taken
+  // before that is not written into the next swap file
+  uint64_t m_generation = 0;
+  bool m_stop = false;
+
+  // guards the swap file; held while a batch is written
+  std::mutex m_io_mutex;
+  int m_fd = -1;
+  uint64_t m_fd_generation = 0;
+
+  std::thread m_thread;
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*** profiler ***/
+
+// Latency histograms of the editor's hot paths. While profiling is off a
+// Timer costs one branch and never reads the clock; while it is on each
+// sample lands in a log-linear histogram with four buckets per power of
+// two, good for percentiles to within a quarter of their value.
+class Profiler
+{
+public:
+  enum Section : uint8_t
+  {
+    KEYPRESS,
+    UPDATE_ROW,
+    UPDATE_SYNTAX,
+    FIND,
+    DRAW_ROWS,
+    WRITE,
+    SECTION_COUNT
+  };
+
+  // Times the scope it lives in.
+  class Timer
+  {
+  public:
+    Timer(Profiler &profiler, Section section)
+        : m_profiler(profiler.m_enabled ? &profiler : nullptr), m_section(section)
+    {
+      if (m_profiler)
+        m_start = std::chrono::steady_clock::now();
+    }
+
+    ~Timer()
+    {
+      if (m_profiler)
+        m_profiler->record(m_section, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                          std::chrono::steady_clock::now() - m_start)
+                                          .count());
+    }
+
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+
+  private:
+    Profiler *m_profiler;
+    Section m_section;
+    std::chrono::steady_clock::time_point m_start;
+  };
+
+  bool enabled() const;
+
+  void setEnabled(bool enabled);
+
+  void record(Section section, uint64_t ns);
+
+  uint64_t count(Section section) const;
+
+  // The latency below which `fraction` of the samples fall, in nanoseconds.
+  uint64_t percentile(Section section, double fraction) const;
+
+  static const char *name(Section section);
+
+  // Appends p50/p99 of every section in microseconds, in one line of at
+  // most `width` columns, without allocating.
+  void appendSummary(std::string &s, std::size_t width) const;
+
+  // Writes a table of every section's percentiles to `path`. Returns false
+  // with errno set if it cannot be written.
+  bool dump(const std::string &path) const;
+
+private:
+  // enough for anything up to 2^40 ns, about 18 minutes
+  static constexpr std::size_t BUCKETS = 160;
+
+  struct Histogram
+  {
+    std::array<uint64_t, BUCKETS> buckets{};
+    uint64_t count = 0;
+    uint64_t total = 0;
+    uint64_t max = 0;
+  };
+
+  static std::size_t bucketOf(uint64_t ns);
+
+  static uint64_t bucketStart(std::size_t bucket);
+
+  bool m_enabled = false;
+  std::array<Histogram, SECTION_COUNT> m_histograms;
+};
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*** regular expressions ***/
+
+// Compiled form of a pattern, shared read-only between threads. The syntax
+// is a small POSIX-like subset: literals, `.`, bracket classes with ranges
+// and negation, \d \w \s and their negations, `^` and `$`, groups,
+// alternation and the `*` `+` `?` quantifiers. Matching is leftmost-longest
+// within a single line.
+class Regex
+{
+public:
+  // Returns nullptr and describes the problem in `error` if the pattern
+  // does not parse.
+  static std::shared_ptr<const Regex> compile(const std::string &pattern, std::string &error);
+
+  enum class Op
+  {
+    CLASS,
+    SPLIT,
+    JMP,
+    MATCH,
+    ASSERT_BEGIN,
+    ASSERT_END
+  };
+
+  struct Inst
+  {
+    Op op;
+    int x = 0;
+    int y = 0;
+  };
+
+  // Thompson NFA: CLASS consumes a byte in m_classes[x] and continues at
+  // the next instruction, SPLIT forks to x and y, JMP goes to x.
+  struct Program
+  {
+    std::vector<Inst> insts;
+    std::vector<std::bitset<256>> classes;
+  };
+
+  const Program &forward() const { return m_forward; }
+
+  // Longest string every match contains, empty if there is none; lines
+  // without it need not be run through the automaton at all.
+  const std::string &requiredLiteral() const { return m_literal; }
+
+  // The program of the reversed pattern, so matches can be found scanning
+  // a line backwards.
+  const Program &reverse() const { return m_reverse; }
+
+private:
+  Program m_forward;
+  Program m_reverse;
+  std::string m_literal;
+};
+
+// Lazily built DFA over one program. States are sets of NFA instructions,
+// created the first time a transition needs them; a single-threaded cache,
+// so every thread matching the same Regex needs its own instance.
+class RegexDfa
+{
+public:
+  static constexpr int DEAD = 0;
+
+  RegexDfa(const Regex::Program &program, bool unanchored);
+
+  // State before the first byte; `at_begin` says whether `^` holds there.
+  int start(bool at_begin);
+
+  int next(int state, unsigned char c)
+  {
+    const int cached = m_next[static_cast<std::size_t>(state) * 256 + c];
+    return cached >= 0 ? cached : addTransition(state, c);
+  }
+
+  // Whether the state has matched, `at_end` saying whether `$` holds.
+  bool accepts(int state, bool at_end) const
+  {
+    return m_accept[state] & (at_end ? ACCEPT_AT_END : ACCEPT);
+  }
+
+  std::size_t stateCount() const;
+
+  void reset();
+
+private:
+  enum : unsigned char
+  {
+    ACCEPT = 1,
+    ACCEPT_AT_END = 2
+  };
+
+  int addTransition(int state, unsigned char c);
+
+  void closure(std::vector<int> &insts, bool at_begin, bool at_end) const;
+
+  int intern(std::vector<int> insts);
+
+  const Regex::Program &m_program;
+  bool m_unanchored;
+  std::vector<int> m_start_mid;
+  int m_start[2];
+  // per state: its instructions, acceptance flags and 256 transitions,
+  // -1 where the target has not been computed yet
+  std::vector<std::vector<int>> m_insts;
+  std::vector<unsigned char> m_accept;
+  std::vector<int> m_next;
+  std::map<std::vector<int>, int> m_ids;
+};
+
+// Finds the matches of a Regex in lines of text. A forward unanchored scan
+// rejects lines without a match. In the others, a backwards scan with the
+// reversed pattern marks every position where a match starts, then a
+// forward anchored run from each of them finds the longest match. A run
+// that reaches a position in a state an earlier run of the line was in
+// there ends the same way, so it stops and takes that run's result: every
+// position is stepped at most once per DFA state, keeping a line linear.
+class RegexMatcher
+{
+public:
+  explicit RegexMatcher(const Regex &regex);
+
+  // Calls fn(start, length) for each non-overlapping match, left to right.
+  template <typename Fn>
+  void forEachMatch(std::string_view line, Fn fn);
+
+private:
+  bool hasMatch(std::string_view line);
+
+  void markStarts(std::string_view line);
+
+  int longestMatch(std::string_view line, std::size_t from);
+
+  // A state some run of the current line was in at a position, and the
+  // end of the longest match that run found from there on, or -1.
+  struct RunEnd
+  {
+    int state;
+    int end;
+    // the next entry for the same position, or -1
+    int next;
+  };
+
+  RegexDfa m_search;
+  RegexDfa m_forward;
+  RegexDfa m_reverse;
+  std::string m_literal;
+  std::vector<char> m_starts;
+  // per position the first of its RunEnd entries, or -1
+  std::vector<int> m_run_heads;
+  std::vector<RunEnd> m_run_ends;
+  std::vector<int> m_path;
+};
+
+template <typename Fn>
+void RegexMatcher::forEachMatch(std::string_view line, Fn fn)
+{
+  if (!hasMatch(line))
+    return;
+
+  markStarts(line);
+
+  for (std::size_t pos = 0; pos <= line.size(); ++pos)
+  {
+    if (!m_starts[pos])
+      continue;
+
+    const int end = longestMatch(line, pos);
+    if (end < 0)
+      continue;
+
+    fn(pos, static_cast<std::size_t>(end) - pos);
+
+    // skip past the match; an empty one still moves on by a byte
+    if (static_cast<std::size_t>(end) > pos)
+      pos = end - 1;
+  }
+}
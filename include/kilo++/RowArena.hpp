@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+/*** row arena ***/
+
+struct ArenaStats
+{
+  // bytes held by live rows and tree nodes
+  std::size_t bytes_in_use = 0;
+  // bytes the arena has taken from the system, including pool slack
+  std::size_t bytes_reserved = 0;
+  // allocations served since the arena was last released
+  std::size_t allocations = 0;
+};
+
+// Memory resource that counts what passes through it on the way upstream.
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+  explicit CountingResource(std::pmr::memory_resource *upstream);
+
+  std::size_t bytes() const;
+
+  std::size_t allocations() const;
+
+  // Forgets the counts, for when the memory was released behind its back.
+  void reset();
+
+private:
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+
+  void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override;
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+  std::pmr::memory_resource *m_upstream;
+  std::size_t m_bytes = 0;
+  std::size_t m_allocations = 0;
+};
+
+// Hands out blocks of one fixed size from large chunks, reusing freed
+// blocks through an intrusive free list. Other sizes go straight upstream.
+class SlabResource : public std::pmr::memory_resource
+{
+public:
+  SlabResource(std::size_t block_size, std::pmr::memory_resource *upstream);
+
+  ~SlabResource() override;
+
+  void release();
+
+private:
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+
+  void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override;
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+  std::size_t m_requested;
+  std::size_t m_block;
+  std::pmr::memory_resource *m_upstream;
+  std::vector<void *> m_chunks;
+  void *m_free = nullptr;
+};
+
+// Backing store for the rows of one buffer: tree nodes come from an
+// exact-size slab, row text longer than the inline buffer and tab and
+// highlight data from size-class pools, all carved out of large chunks so
+// a million-line file does not cost millions of separate mallocs. Not
+// thread-safe; only the thread that edits the buffer may allocate.
+class RowArena
+{
+public:
+  explicit RowArena(std::size_t node_size);
+
+  RowArena(const RowArena &) = delete;
+  RowArena &operator=(const RowArena &) = delete;
+
+  // For the contents of rows.
+  std::pmr::memory_resource *resource();
+
+  // For nodes of the size given at construction.
+  std::pmr::memory_resource *nodeResource();
+
+  ArenaStats stats() const;
+
+  // Returns every chunk to the system at once. Anything still allocated
+  // from the arena is gone afterwards, without its destructor having run.
+  void release();
+
+private:
+  CountingResource m_system;
+  std::pmr::unsynchronized_pool_resource m_pool;
+  SlabResource m_slab;
+  CountingResource m_front;
+  CountingResource m_node_front;
+};
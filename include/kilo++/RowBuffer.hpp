@@ -0,0 +1,225 @@
+#pragma once
+
+#include "kilo++/EditorRow.hpp"
+#include "kilo++/FileSource.hpp"
+#include "kilo++/RowArena.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+/*** row buffer ***/
+
+// Heap bytes held by the rows of a buffer, by what holds them.
+struct RowMemory
+{
+  // the text of materialized rows longer than the inline buffer
+  std::size_t text = 0;
+  // tab positions and highlight spans, both worked out from the text again
+  // whenever they are needed
+  std::size_t tabs = 0;
+  std::size_t hl = 0;
+  // tree nodes, runs included
+  std::size_t nodes = 0;
+  // the source's line index and the screen lines of its lines
+  std::size_t index = 0;
+};
+
+// Ordered sequence of rows stored as an implicit treap: every node keeps the
+// number of lines in its subtree, so rows are addressed by position without
+// storing an index in the row itself. Lookup, insertion and deletion are
+// O(log N) and references to rows stay valid while other rows are inserted
+// or erased.
+//
+// Lines loaded from a FileSource start out as runs: a single node standing
+// for a range of unmodified lines in the mapping. A run is split and the
+// line materialized into an EditorRow only when operator[] touches it.
+//
+// With wrapping on, every node also keeps how many screen lines its rows
+// take and the total over its subtree, so a screen line is mapped to its row
+// and back in O(log N). A run reads the counts of its lines from a prefix
+// sum over the mapping's lines, built once per wrap width.
+//
+// Nodes and the rows in them live in a RowArena owned by the buffer, which
+// clear() and assign() hand back to the system in one go.
+class RowBuffer
+{
+public:
+  using Materializer = std::function<void(EditorRow &)>;
+  // Columns a line takes on the screen.
+  using WidthFn = std::function<std::size_t(std::string_view)>;
+
+  RowBuffer() = default;
+  ~RowBuffer();
+
+  RowBuffer(const RowBuffer &) = delete;
+  RowBuffer &operator=(const RowBuffer &) = delete;
+
+  RowBuffer(RowBuffer &&other) noexcept;
+  RowBuffer &operator=(RowBuffer &&other) noexcept;
+
+  // Replaces the contents with all lines of `source`, none materialized.
+  void assign(std::shared_ptr<const FileSource> source);
+
+  // Called on every row created from a run, after its text is filled in.
+  void setMaterializer(Materializer materializer);
+
+  std::size_t size() const;
+
+  bool empty() const;
+
+  bool isMaterialized(std::size_t index) const;
+
+  EditorRow &operator[](std::size_t index);
+
+  // Turns every run into rows, so nothing is read from the source any more.
+  void materializeAll();
+
+  // Text of line `index`, read from the mapping if it is still part of a run.
+  std::string_view lineAt(std::size_t index) const;
+
+  void insert(std::size_t index, EditorRow erow);
+
+  void erase(std::size_t index);
+
+  void clear();
+
+  // Picks up what the source gained in FileSource::grow() when it had
+  // `old_lines` lines: the new lines go at the end as a run, and the last row
+  // is read again if it was materialized and recounted for wrapping in case
+  // it got longer.
+  void appendSourceLines(std::size_t old_lines);
+
+  // Visits the text of every line in order without materializing runs.
+  void forEachLine(const std::function<void(std::string_view)> &fn) const;
+
+  // Same for lines [first, last), passing each line's index along. Only reads
+  // the tree, so disjoint ranges can be visited from several threads.
+  void forEachLine(std::size_t first, std::size_t last,
+                   const std::function<void(std::size_t, std::string_view)> &fn) const;
+
+  void forEachMaterialized(const std::function<void(EditorRow &)> &fn);
+
+  ArenaStats memoryStats() const;
+
+  // Adds up what every row holds; walks the whole tree, unlike memoryStats().
+  RowMemory memoryUsage() const;
+
+  // RowMemory::index without the walk.
+  std::size_t indexBytes() const;
+
+  // Frees the tab positions and highlight spans of the materialized rows
+  // outside [keep_first, keep_last]. Such a row has the materializer run on
+  // it again the next time operator[] reaches it, and is left to be
+  // highlighted again. Returns the bytes freed.
+  std::size_t evictDerived(std::size_t keep_first, std::size_t keep_last);
+
+  // Moves every node and row into a fresh arena and releases the old one,
+  // so memory freed back to its pools goes back to the system.
+  void compact();
+
+  /*** wrapping ***/
+
+  // Wraps lines at `cols` columns as measured by `width`: a line takes
+  // width / cols + 1 screen lines. 0 turns wrapping off and makes every line
+  // one screen line. assign() and clear() turn it off.
+  void setWrap(int cols, WidthFn width);
+
+  int wrapColumns() const;
+
+  // Recounts the screen lines of row `index` after its text changed.
+  void rewrap(std::size_t index);
+
+  std::size_t visualLines() const;
+
+  std::size_t visualLinesAt(std::size_t index) const;
+
+  // Screen line on which row `index` starts; size() gives visualLines().
+  std::size_t visualLineOf(std::size_t index) const;
+
+  // Row shown on screen line `vline`, with the screen lines of that row
+  // above it in `offset`. Lines past the end map to size().
+  std::size_t rowAtVisualLine(std::size_t vline, std::size_t &offset) const;
+
+private:
+  struct Node
+  {
+    Node(EditorRow &&erow, uint32_t prio, const EditorRow::allocator_type &alloc)
+        : row(std::move(erow), alloc), priority(prio) {}
+
+    Node(std::size_t first_line, std::size_t lines, uint32_t prio, const EditorRow::allocator_type &alloc)
+        : row(alloc), priority(prio), materialized(false), count(lines), size(lines), source_line(first_line),
+          vlines(lines), vsize(lines) {}
+
+    EditorRow row;
+    uint32_t priority;
+    bool materialized = true;
+    // the row's tabs and spans were dropped by evictDerived()
+    bool evicted = false;
+    std::size_t count = 1;
+    std::size_t size = 1;
+    std::size_t source_line = 0;
+    // screen lines of this node's rows and of its whole subtree
+    std::size_t vlines = 1;
+    std::size_t vsize = 1;
+    Node *left = nullptr;
+    Node *right = nullptr;
+  };
+
+  static std::size_t sizeOf(const Node *node);
+
+  static std::size_t vsizeOf(const Node *node);
+
+  static void update(Node *node);
+
+  void split(Node *node, std::size_t count, Node *&left, Node *&right);
+
+  static Node *merge(Node *left, Node *right);
+
+  template <typename... Args>
+  Node *newNode(Args &&...args);
+
+  void destroy(Node *node);
+
+  RowArena &arena();
+
+  const Node *find(std::size_t &index) const;
+
+  void visitLines(const Node *node, const std::function<void(std::string_view)> &fn) const;
+
+  void visitRange(const Node *node, std::size_t base, std::size_t first, std::size_t last,
+                  const std::function<void(std::size_t, std::string_view)> &fn) const;
+
+  void visitMaterialized(Node *node, const std::function<void(EditorRow &)> &fn);
+
+  static void tallyMemory(const Node *node, RowMemory &memory);
+
+  static std::size_t evictDerived(Node *node, std::size_t base, std::size_t keep_first,
+                                  std::size_t keep_last);
+
+  Node *copyTree(Node *node);
+
+  uint32_t nextPriority();
+
+  std::size_t lineVisuals(std::string_view line) const;
+
+  std::size_t runVisuals(std::size_t first_line, std::size_t lines) const;
+
+  void rewrap(Node *node, std::size_t index);
+
+  void rewrapAll(Node *node);
+
+  std::unique_ptr<RowArena> m_arena;
+  Node *m_root = nullptr;
+  uint32_t m_seed = 0x9e3779b9u;
+  std::shared_ptr<const FileSource> m_source;
+  Materializer m_materializer;
+
+  int m_wrap_cols = 0;
+  WidthFn m_width;
+  // screen lines of the mapping's lines before each one, at m_wrap_cols
+  std::vector<std::size_t> m_source_visuals;
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "kilo++/RowBuffer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*** substring search ***/
+
+// Position of the first occurrence of `needle` in `haystack` at or after
+// `from`, or std::string_view::npos. Candidates are filtered 16 or 32 bytes
+// at a time by comparing the needle's first and last bytes (SSE2, or AVX2
+// when the CPU has it) before the middle is compared.
+std::size_t findSubstring(std::string_view haystack, std::string_view needle, std::size_t from = 0);
+
+/*** match index ***/
+
+struct SearchMatch
+{
+  int row;
+  int col;
+  int len;
+};
+
+inline bool operator<(const SearchMatch &a, const SearchMatch &b)
+{
+  return a.row < b.row || (a.row == b.row && a.col < b.col);
+}
+
+enum class SearchMode
+{
+  LITERAL,
+  REGEX
+};
+
+// Every occurrence of a query in the buffer, in buffer order, with columns
+// in row (not rendered) coordinates. A fresh scan splits the buffer into
+// chunks of lines searched on the shared thread pool. For literal queries
+// the results of shorter queries typed in the same prompt are kept:
+// extending a query only re-checks the previous matches, and deleting
+// characters returns the earlier list directly.
+class SearchIndex
+{
+public:
+  const std::vector<SearchMatch> &update(const RowBuffer &rows, uint64_t version,
+                                         const std::string &query,
+                                         SearchMode mode = SearchMode::LITERAL);
+
+  // Why the last regex query has no matches if it failed to compile.
+  const std::string &error() const;
+
+  void clear();
+
+private:
+  struct Level
+  {
+    std::string query;
+    std::vector<SearchMatch> matches;
+  };
+
+  static void scan(const RowBuffer &rows, const std::string &query,
+                   std::vector<SearchMatch> &matches);
+
+  static void scanRegex(const RowBuffer &rows, const std::string &pattern,
+                        std::vector<SearchMatch> &matches, std::string &error);
+
+  static void refine(const RowBuffer &rows, const std::string &query,
+                     const std::vector<SearchMatch> &candidates,
+                     std::vector<SearchMatch> &matches);
+
+  uint64_t m_version = 0;
+  SearchMode m_mode = SearchMode::LITERAL;
+  std::vector<Level> m_levels;
+  std::string m_error;
+  const std::vector<SearchMatch> m_no_matches;
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "kilo++/EditorRow.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <string_view>
+#include <vector>
+
+/*** defines ***/
+
+#define HL_HIGHLIGHT_NUMBERS (1 << 0)
+#define HL_HIGHLIGHT_STRINGS (1 << 1)
+
+/*** keyword table ***/
+
+// Perfect hash over a syntax's keywords, built once per syntax. Keywords
+// ending in '|' are secondary (KEYWORD2); the marker is stripped and the
+// category resolved at build time, so tokenizing does a single probe per
+// identifier instead of comparing against every keyword.
+class KeywordTable
+{
+public:
+  KeywordTable() = default;
+
+  explicit KeywordTable(const std::vector<std::string> &keywords);
+
+  // Returns NORMAL when `token` is not a keyword.
+  EditorHighlight lookup(std::string_view token) const;
+
+  bool empty() const;
+
+  // Appends the built table to `out`, for reading back with load() instead
+  // of searching for a perfect hash again.
+  void save(std::string &out) const;
+
+  // Reads a table written by save() from the front of `in` and advances
+  // past it. Returns false if `in` does not hold a well-formed table.
+  bool load(std::string_view &in);
+
+private:
+  struct Slot
+  {
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    EditorHighlight hl = EditorHighlight::NORMAL;
+  };
+
+  static uint32_t hash(std::string_view token, uint32_t seed);
+
+  bool build(const std::vector<std::pair<std::string_view, EditorHighlight>> &entries,
+             std::size_t table_size, uint32_t seed);
+
+  std::string m_words;
+  std::vector<Slot> m_slots;
+  uint32_t m_mask = 0;
+  uint32_t m_seed = 0;
+  std::size_t m_min_len = 0;
+  std::size_t m_max_len = 0;
+};
+
+/*** data ***/
+
+struct EditorSyntax
+{
+  std::string filetype;
+  std::vector<std::string> filematch;
+  std::vector<std::string> keywords;
+  std::string singleline_comment_start;
+  std::string multiline_comment_start;
+  std::string multiline_comment_end;
+  int32_t flags;
+  KeywordTable keyword_table = {};
+};
+
+/*** syntax highlighting ***/
+
+bool isSeparator(int c);
+
+// Builds the lookup tables derived from the syntax definition.
+void compileSyntax(EditorSyntax &syntax);
+
+// Makes a compiled definition available to findSyntax(), ahead of the
+// built-in ones and any registered before it.
+void registerSyntax(std::shared_ptr<const EditorSyntax> syntax);
+
+// The compiled definition for a file name, shared by every buffer that
+// uses it, or nullptr if no filetype matches.
+std::shared_ptr<const EditorSyntax> findSyntax(const std::string &filename);
+
+// Highlights the text of one row into the spans `hl`, starting inside a
+// multi-line comment if `in_comment` is set, and returns whether the row
+// ends inside one. Depends on nothing but its arguments, so it may run on
+// any thread.
+bool highlightRow(const EditorSyntax &syntax, std::string_view text, bool in_comment,
+                  std::pmr::vector<HighlightSpan> &hl);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "kilo++/Syntax.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*** syntax files ***/
+
+// Syntax definitions are read from *.syntax files, one filetype per file,
+// each line a key followed by its values:
+//
+//   filetype python
+//   filematch .py .pyw
+//   keywords def class if elif else
+//   keywords2 int str float
+//   comment #
+//   multiline_comment """ """
+//   highlight numbers strings
+//
+// keywords2 lists the secondary keywords; keywords and keywords2 may be
+// repeated, and a keyword may not contain a separator (see isSeparator()).
+// Lines starting with '#' are ignored.
+
+// Parses the text of one definition file into `syntax`, without compiling
+// it. On failure returns false and leaves a message naming the offending
+// line in `error`.
+bool parseSyntax(std::string_view text, EditorSyntax &syntax, std::string &error);
+
+// Loads and registers the definitions found in `dirs`, so that a file in a
+// later directory takes precedence over those before it. The compiled
+// definitions are kept in the binary cache at `cache_path`, which is reused
+// for as long as the same files are there with the same modification times
+// and sizes, and rebuilt otherwise. Returns one message per file that could
+// not be loaded.
+std::vector<std::string> loadSyntaxFiles(const std::vector<std::string> &dirs, const std::string &cache_path);
+
+// The system-wide definitions installed with the editor, then the user's in
+// $XDG_CONFIG_HOME/kilo++/syntax.
+std::vector<std::string> syntaxDirectories();
+
+// $XDG_CACHE_HOME/kilo++/syntax.cache, or empty if there is no home.
+std::string syntaxCachePath();
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "kilo++/EditorRow.hpp"
+#include "kilo++/Syntax.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*** background highlighting ***/
+
+// Snapshot of a contiguous run of stale rows, taken at buffer `version`.
+struct HighlightJob
+{
+  uint64_t version = 0;
+  int first_row = 0;
+  bool in_comment = false;
+  std::shared_ptr<const EditorSyntax> syntax;
+  std::vector<std::string> text;
+};
+
+struct HighlightResult
+{
+  uint64_t version = 0;
+  int first_row = 0;
+  bool in_comment = false;
+  std::vector<std::pmr::vector<HighlightSpan>> hl;
+  std::vector<bool> open_comment;
+};
+
+// Highlights snapshots on a dedicated thread. Only the most recent job is
+// kept: submitting a new one drops a job that has not started yet. Results
+// are handed back through take(); notifyFd() becomes readable whenever one
+// is waiting, so the caller can poll it together with its input.
+class SyntaxWorker
+{
+public:
+  SyntaxWorker();
+  ~SyntaxWorker();
+
+  SyntaxWorker(const SyntaxWorker &) = delete;
+  SyntaxWorker &operator=(const SyntaxWorker &) = delete;
+
+  void submit(HighlightJob job);
+
+  bool take(HighlightResult &result);
+
+  // Whether a submitted job is queued or being highlighted.
+  bool busy();
+
+  int notifyFd() const;
+
+private:
+  void loop();
+
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  std::unique_ptr<HighlightJob> m_job;
+  std::unique_ptr<HighlightResult> m_result;
+  bool m_running = false;
+  bool m_stop = false;
+  int m_pipe[2] = {-1, -1};
+  std::thread m_thread;
+};
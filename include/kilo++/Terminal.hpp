@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+
+/*** terminal ***/
+
+// What the editor draws on and reads keys from. The editor itself only
+// composes frames and interprets keys, so it runs the same on a real
+// terminal and headless.
+class Terminal
+{
+public:
+  virtual ~Terminal() = default;
+
+  virtual bool getWindowSize(int &rows, int &cols) = 0;
+
+  virtual void write(std::string_view bytes) = 0;
+
+  // Next key, an EditorKey or a byte. A bracketed paste comes back as a
+  // single EditorKey::PASTE with its text in pastedText().
+  virtual int readKey() = 0;
+
+  // Whether readKey() has a key without waiting.
+  virtual bool inputPending() = 0;
+
+  virtual const std::string &pastedText() = 0;
+
+  // Descriptors the event loop polls for input and for resizes, or -1 for
+  // none.
+  virtual int inputFd() = 0;
+
+  virtual int resizeFd() = 0;
+
+  // Whether the window was resized since the last call.
+  virtual bool takeResize() = 0;
+};
+
+// The controlling terminal, in raw mode for as long as this lives.
+class TtyTerminal : public Terminal
+{
+public:
+  TtyTerminal();
+
+  // Clears the screen and restores the terminal's original mode.
+  ~TtyTerminal() override;
+
+  TtyTerminal(const TtyTerminal &) = delete;
+  TtyTerminal &operator=(const TtyTerminal &) = delete;
+
+  bool getWindowSize(int &rows, int &cols) override;
+
+  void write(std::string_view bytes) override;
+
+  int readKey() override;
+
+  bool inputPending() override;
+
+  const std::string &pastedText() override;
+
+  int inputFd() override;
+
+  int resizeFd() override;
+
+  bool takeResize() override;
+};
+
+// A screen of fixed size that counts what is drawn on it and hands out keys
+// queued in advance. Reading a key when none is left throws
+// std::runtime_error.
+class HeadlessTerminal : public Terminal
+{
+public:
+  HeadlessTerminal(int rows, int cols);
+
+  void pushKey(int key);
+
+  // Queues every byte of `text` as a key.
+  void pushText(std::string_view text);
+
+  // Queues the keys a terminal sending `input` would produce, escape
+  // sequences and bracketed pastes included.
+  void pushInput(std::string_view input);
+
+  void pushPaste(std::string text);
+
+  std::size_t bytesWritten() const;
+
+  bool getWindowSize(int &rows, int &cols) override;
+
+  void write(std::string_view bytes) override;
+
+  int readKey() override;
+
+  bool inputPending() override;
+
+  const std::string &pastedText() override;
+
+  int inputFd() override;
+
+  int resizeFd() override;
+
+  bool takeResize() override;
+
+private:
+  int m_rows;
+  int m_cols;
+  std::size_t m_bytes_written = 0;
+  std::deque<int> m_keys;
+  std::deque<std::string> m_pastes;
+  std::string m_paste;
+};
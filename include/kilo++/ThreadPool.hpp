@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*** thread pool ***/
+
+// Fixed set of worker threads for data-parallel loops. parallelFor() is
+// the only entry point: the calling thread takes part in the work and the
+// call returns once every chunk has run. Calls from inside a chunk run
+// inline instead of deadlocking on the pool.
+class ThreadPool
+{
+public:
+  using RangeFn = std::function<void(std::size_t begin, std::size_t end)>;
+
+  // Process-wide pool sized to the hardware concurrency.
+  static ThreadPool &shared();
+
+  explicit ThreadPool(unsigned threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Number of threads that work on a loop, including the caller.
+  unsigned concurrency() const;
+
+  // Runs fn over [0, count) in chunks of at least `grain` items.
+  void parallelFor(std::size_t count, std::size_t grain, const RangeFn &fn);
+
+private:
+  void workerLoop();
+
+  void runChunks();
+
+  std::vector<std::thread> m_workers;
+  std::mutex m_batch_mutex;
+
+  std::mutex m_mutex;
+  std::condition_variable m_work_cond;
+  std::condition_variable m_done_cond;
+  const RangeFn *m_fn = nullptr;
+  std::size_t m_count = 0;
+  std::size_t m_chunk = 0;
+  std::atomic<std::size_t> m_next{0};
+  std::size_t m_pending = 0;
+  uint64_t m_generation = 0;
+  bool m_stop = false;
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*** undo log ***/
+
+// Append-only record of the edits made to a buffer, grouped into the steps
+// undo and redo move by. An edit keeps only the span it touched: the
+// characters or the row it inserted or deleted, or where a row was split or
+// joined. Nothing ever copies the buffer, so history stays cheap on huge
+// files. Once the log outgrows its memory limit the oldest groups go.
+class UndoLog
+{
+public:
+  enum class Op : uint8_t
+  {
+    INSERT_CHARS,
+    DELETE_CHARS,
+    INSERT_ROW,
+    DELETE_ROW,
+    SPLIT_ROW,
+    JOIN_ROWS
+  };
+
+  // Groups of the same kind merge while the cursor stays where the last one
+  // left it and keys keep coming; OTHER groups never do.
+  enum class Kind : uint8_t
+  {
+    TYPING,
+    DELETING,
+    OTHER
+  };
+
+  struct Cursor
+  {
+    int cx;
+    int cy;
+
+    bool operator==(const Cursor &other) const { return cx == other.cx && cy == other.cy; }
+  };
+
+  explicit UndoLog(std::size_t memory_limit);
+
+  // Opens a group for the edits of one command, reopening the last group if
+  // the command continues it. Anything left to redo is discarded.
+  void begin(Kind kind, Cursor cursor);
+
+  // Logs an edit of the open group. INSERT_CHARS and DELETE_CHARS carry the
+  // characters, INSERT_ROW and DELETE_ROW the row's text; SPLIT_ROW and
+  // JOIN_ROWS only the column where the row is cut.
+  void record(Op op, int row, int col, std::string_view text);
+
+  void end(Cursor cursor);
+
+  // Closes the last group, so the next edit starts a new one.
+  void seal();
+
+  // Passes the inverse of each edit of the last group to
+  // apply(op, row, col, text), newest first, and sets `cursor` to where it
+  // was before the group. Returns false if there is nothing to undo.
+  template <typename Fn>
+  bool undo(Fn apply, Cursor &cursor);
+
+  // Replays the next undone group and sets `cursor` to where it was after.
+  template <typename Fn>
+  bool redo(Fn apply, Cursor &cursor);
+
+  void clear();
+
+  // Remembers the current state as the one on disk.
+  void markSaved();
+
+  bool atSavedPoint() const;
+
+  // For when no state in the log is the one on disk.
+  void forgetSavedPoint();
+
+  std::size_t memoryUsage() const;
+
+  void setMemoryLimit(std::size_t limit);
+
+  static Op inverse(Op op);
+
+private:
+  struct Edit
+  {
+    Op op;
+    int row;
+    int col;
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  struct Group
+  {
+    uint64_t id;
+    Kind kind;
+    bool sealed = false;
+    Cursor before;
+    Cursor after;
+    std::vector<Edit> edits;
+    // the text of every edit, back to back
+    std::string text;
+    std::size_t bytes = 0;
+    std::chrono::steady_clock::time_point last;
+  };
+
+  uint64_t position() const;
+
+  void trim();
+
+  std::deque<Group> m_groups;
+  // groups before this index are applied, the rest can be redone
+  std::size_t m_applied = 0;
+  bool m_open = false;
+  uint64_t m_next_id = 1;
+  // id of the newest group dropped off the front, 0 for none
+  uint64_t m_dropped_id = 0;
+  uint64_t m_saved_id = 0;
+  std::size_t m_bytes = 0;
+  std::size_t m_limit;
+};
+
+template <typename Fn>
+bool UndoLog::undo(Fn apply, Cursor &cursor)
+{
+  if (m_applied == 0)
+    return false;
+
+  auto &group = m_groups[--m_applied];
+  group.sealed = true;
+  for (auto it = group.edits.rbegin(); it != group.edits.rend(); ++it)
+    apply(inverse(it->op), it->row, it->col, std::string_view(group.text).substr(it->offset, it->length));
+
+  cursor = group.before;
+  return true;
+}
+
+template <typename Fn>
+bool UndoLog::redo(Fn apply, Cursor &cursor)
+{
+  if (m_applied == m_groups.size())
+    return false;
+
+  const auto &group = m_groups[m_applied++];
+  for (const auto &edit : group.edits)
+    apply(edit.op, edit.row, edit.col, std::string_view(group.text).substr(edit.offset, edit.length));
+
+  cursor = group.after;
+  return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+/*** utf-8 ***/
+
+// What the editor needs to know about UTF-8 text to lay it out on a
+// terminal. Rows are stored as bytes; these work out which bytes make up
+// one character on the screen and how many columns it takes.
+namespace utf8
+{
+  // Whether every byte of `s` is below 0x80, checked a vector at a time.
+  bool isAscii(std::string_view s);
+
+  // Length of the sequence starting at s[at] with its code point in `cp`,
+  // or 0 if the bytes there are not valid UTF-8.
+  std::size_t decode(std::string_view s, std::size_t at, char32_t &cp);
+
+  // Columns a code point takes on a terminal: 0 for combining marks and
+  // other zero-width ones, 2 for East Asian wide and most emoji, 1 otherwise.
+  int width(char32_t cp);
+
+  // One character as drawn: a code point along with the zero-width ones
+  // following it, and whatever a zero-width joiner glues on.
+  struct Cluster
+  {
+    std::size_t end;
+    int width;
+    // false for controls and bytes that do not decode, which take one
+    // column drawn as a placeholder
+    bool printable;
+  };
+
+  Cluster cluster(std::string_view s, std::size_t at);
+
+  // Start of the character covering byte `at`.
+  std::size_t clusterStart(std::string_view s, std::size_t at);
+}
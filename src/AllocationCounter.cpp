@@ -0,0 +1,73 @@
+#include "kilo++/AllocationCounter.hpp"
+
+#include <cstdlib>
+#include <new>
+
+#ifndef NDEBUG
+
+namespace
+{
+  thread_local std::size_t allocations = 0;
+
+  void *allocate(std::size_t size)
+  {
+    allocations++;
+    if (size == 0)
+      size = 1;
+
+    while (true)
+    {
+      if (void *p = std::malloc(size))
+        return p;
+
+      const auto handler = std::get_new_handler();
+      if (!handler)
+        throw std::bad_alloc();
+      handler();
+    }
+  }
+}
+
+void *operator new(std::size_t size)
+{
+  return allocate(size);
+}
+
+void *operator new[](std::size_t size)
+{
+  return allocate(size);
+}
+
+void operator delete(void *p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+std::size_t allocation_counter::count()
+{
+  return allocations;
+}
+
+#else
+
+std::size_t allocation_counter::count()
+{
+  return 0;
+}
+
+#endif
@@ -0,0 +1,193 @@
+#include "kilo++/AtomicFile.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+AtomicFile::AtomicFile(std::string path)
+    : m_path(std::move(path))
+{
+}
+
+AtomicFile::~AtomicFile()
+{
+  if (m_fd != -1)
+    close(m_fd);
+
+  if (!m_committed && !m_tmp_path.empty())
+    unlink(m_tmp_path.c_str());
+}
+
+bool AtomicFile::open()
+{
+  // the file a symlink points to is the one replaced; a file that doesn't
+  // exist yet is created under the name given
+  struct stat st;
+  bool exists = false;
+  if (char *real = realpath(m_path.c_str(), nullptr))
+  {
+    m_target = real;
+    std::free(real);
+    exists = stat(m_target.c_str(), &st) == 0;
+  }
+  else if (errno == ENOENT)
+  {
+    // a dangling symlink is written through, creating what it points to
+    m_target = m_path;
+    if (lstat(m_path.c_str(), &st) == 0 && S_ISLNK(st.st_mode))
+      return openInPlace();
+  }
+  else
+  {
+    return false;
+  }
+
+  // renaming over a file with other names would leave them on the old contents
+  if (exists && st.st_nlink > 1)
+    return openInPlace();
+
+  std::string name = m_target + ".kilo~XXXXXX";
+  m_fd = mkstemp(name.data());
+  if (m_fd == -1)
+    return exists && openInPlace();
+  m_tmp_path = std::move(name);
+
+  // mkstemp() creates the file 0600 and ours; give it the original's owner
+  // and mode, or the usual mode of a new file. The owner goes first, as
+  // changing it can clear the set-id bits.
+  mode_t mode;
+  if (exists)
+  {
+    if ((st.st_uid != geteuid() || st.st_gid != getegid()) && fchown(m_fd, st.st_uid, st.st_gid) == -1)
+    {
+      close(m_fd);
+      m_fd = -1;
+      unlink(m_tmp_path.c_str());
+      m_tmp_path.clear();
+      return openInPlace();
+    }
+    mode = st.st_mode & 07777;
+  }
+  else
+  {
+    const mode_t mask = umask(0);
+    umask(mask);
+    mode = 0666 & ~mask;
+  }
+
+  if (fchmod(m_fd, mode) == -1)
+    return false;
+
+  m_iov.reserve(IOV_MAX);
+  return true;
+}
+
+bool AtomicFile::inPlace() const
+{
+  return m_in_place;
+}
+
+bool AtomicFile::append(std::string_view data)
+{
+  if (data.empty())
+    return true;
+
+  m_iov.push_back({const_cast<char *>(data.data()), data.size()});
+  m_bytes += data.size();
+
+  return m_iov.size() < IOV_MAX || flush();
+}
+
+bool AtomicFile::commit()
+{
+  if (!flush())
+    return false;
+
+  // whatever is left of the old contents past the new ones is cut off
+  if (m_in_place && ftruncate(m_fd, static_cast<off_t>(m_bytes)) == -1)
+    return false;
+
+  if (fsync(m_fd) == -1)
+    return false;
+
+  const int fd = m_fd;
+  m_fd = -1;
+  if (close(fd) == -1)
+    return false;
+
+  if (m_in_place)
+  {
+    m_committed = true;
+    return true;
+  }
+
+  if (rename(m_tmp_path.c_str(), m_target.c_str()) == -1)
+    return false;
+  m_committed = true;
+
+  // make the rename itself durable
+  const auto slash = m_target.rfind('/');
+  const std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : m_target.substr(0, slash));
+  const int dirfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (dirfd != -1)
+  {
+    fsync(dirfd);
+    close(dirfd);
+  }
+  return true;
+}
+
+std::size_t AtomicFile::bytesWritten() const
+{
+  return m_bytes;
+}
+
+// Writes straight over the file from its start, for when it can't be
+// replaced without losing something.
+bool AtomicFile::openInPlace()
+{
+  m_in_place = true;
+  m_fd = ::open(m_target.c_str(), O_WRONLY | O_CREAT, 0666);
+  if (m_fd == -1)
+    return false;
+
+  m_iov.reserve(IOV_MAX);
+  return true;
+}
+
+bool AtomicFile::flush()
+{
+  std::size_t first = 0;
+  while (first < m_iov.size())
+  {
+    const int count = static_cast<int>(m_iov.size() - first);
+    const ssize_t written = writev(m_fd, m_iov.data() + first, count);
+    if (written == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+
+    // step over what went out, resuming inside a piece after a short write
+    auto left = static_cast<std::size_t>(written);
+    while (first < m_iov.size() && left >= m_iov[first].iov_len)
+      left -= m_iov[first++].iov_len;
+    if (left)
+    {
+      m_iov[first].iov_base = static_cast<char *>(m_iov[first].iov_base) + left;
+      m_iov[first].iov_len -= left;
+    }
+  }
+
+  m_iov.clear();
+  return true;
+}
@@ -0,0 +1,95 @@
+#include "kilo++/Batch.hpp"
+#include "kilo++/Editor.hpp"
+#include "kilo++/EditorUtils.hpp"
+#include "kilo++/Terminal.hpp"
+#include "kilo++/ThreadPool.hpp"
+
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <sys/stat.h>
+#include <utility>
+
+// the size of the screen a script is replayed on, which is what page keys
+// move by
+#define KILO_BATCH_ROWS 24
+#define KILO_BATCH_COLS 80
+
+namespace
+{
+  // Indices of `files` without the ones naming a file already listed, by
+  // another path, a symlink or a hard link, which would otherwise be
+  // edited twice at once with the last save winning. Files that don't exist
+  // yet are told apart by their absolute paths.
+  std::vector<std::size_t> distinctFiles(const std::vector<std::string> &files)
+  {
+    std::set<std::pair<dev_t, ino_t>> inodes;
+    std::set<std::string> missing;
+    std::vector<std::size_t> distinct;
+    for (std::size_t i = 0; i < files.size(); ++i)
+    {
+      struct stat st;
+      bool added;
+      if (stat(files[i].c_str(), &st) == 0)
+      {
+        added = inodes.emplace(st.st_dev, st.st_ino).second;
+      }
+      else
+      {
+        std::error_code ec;
+        const auto path = std::filesystem::weakly_canonical(files[i], ec);
+        added = missing.insert(ec ? files[i] : path.string()).second;
+      }
+
+      if (added)
+        distinct.push_back(i);
+    }
+    return distinct;
+  }
+}
+
+std::size_t runBatch(const std::string &script, const std::vector<std::string> &files, std::ostream &err)
+{
+  std::ifstream ifs(script, std::ios::binary);
+  if (!ifs)
+    terminal_manager::die(script.c_str());
+
+  std::ostringstream ss;
+  ss << ifs.rdbuf();
+  const std::string keys = ss.str();
+
+  // each file is independent; an editor per file keeps them that way, as
+  // long as no file is named twice
+  const auto targets = distinctFiles(files);
+  std::vector<std::string> errors(files.size());
+  ThreadPool::shared().parallelFor(targets.size(), 1, [&](std::size_t begin, std::size_t end)
+                                   {
+                                     for (std::size_t t = begin; t < end; ++t)
+                                     {
+                                       const auto i = targets[t];
+                                       try
+                                       {
+                                         auto terminal = std::make_unique<HeadlessTerminal>(KILO_BATCH_ROWS, KILO_BATCH_COLS);
+                                         terminal->pushInput(keys);
+                                         Editor editor(std::move(terminal));
+                                         editor.runScript(files[i], errors[i]);
+                                       }
+                                       catch (const std::exception &e)
+                                       {
+                                         errors[i] = files[i] + ": " + e.what();
+                                       }
+                                     } });
+
+  std::size_t failed = 0;
+  for (const auto &error : errors)
+  {
+    if (error.empty())
+      continue;
+    err << error << '\n';
+    failed++;
+  }
+  return failed;
+}
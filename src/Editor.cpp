@@ -4,16 +4,31 @@
 #define _BSD_SOURCE
 
 #include "kilo++/Editor.hpp"
+#include "kilo++/AllocationCounter.hpp"
+#include "kilo++/AtomicFile.hpp"
 #include "kilo++/EditorUtils.hpp"
+#include "kilo++/FileSource.hpp"
+#include "kilo++/Syntax.hpp"
+#include "kilo++/SyntaxFile.hpp"
+#include "kilo++/ThreadPool.hpp"
+#include "kilo++/Utf8.hpp"
 
 #include <algorithm>
 #include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
 #include <cstdarg>
+#include <cstdlib>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
-#include <sstream>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <mutex>
+#include <poll.h>
 #include <unistd.h>
 
 /*** defines ***/
@@ -22,219 +37,422 @@
 #define KILO_TAB_STOP 8
 #define KILO_QUIT_TIMES 3
 #define FILENAME_DISPLAY_LEN 20
+#define KILO_HL_SYNC_ROWS 64
+#define KILO_HL_BATCH_ROWS 4096
+#define KILO_HL_INDEX_GRAIN 1024
+#define KILO_STATUS_TIMEOUT 5
+#define KILO_FRAME_INTERVAL_MS 16
+#define KILO_UNDO_MEMORY_LIMIT (64 << 20)
+#define KILO_EVICT_MARGIN_ROWS 1024
 
 #define CTRL_KEY(k) ((k) & 0x1f)
 
-#define HL_HIGHLIGHT_NUMBERS (1 << 0)
-#define HL_HIGHLIGHT_STRINGS (1 << 1)
-
-/*** filetypes ***/
-
-const std::vector<std::string_view> C_HL_EXTENSIONS = {".c", ".h", ".cpp", ".hpp"};
-const std::vector<std::string_view> C_HL_KEYWORDS = {
-    "switch", "if", "while", "for", "break", "continue", "return", "else", "struct", "union", "typedef", "static", "const",
-    "enum", "class", "case", "int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|", "auto|", "void|"};
-
-const EditorSyntax HLDB[] = {
-    {"c",
-     C_HL_EXTENSIONS,
-     C_HL_KEYWORDS,
-     "//", "/*", "*/",
-     HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS},
-};
-
 /*** constructor ***/
 
 Editor::Editor()
+    : Editor(std::make_unique<TtyTerminal>())
 {
-  terminal_manager::enableRawMode();
+}
 
-  if (terminal_manager::getWindowSize(&m_screenrows, &m_screencols) == -1)
+Editor::Editor(std::unique_ptr<Terminal> terminal)
+    : m_term(std::move(terminal)),
+      m_quit_times(KILO_QUIT_TIMES),
+      m_close_times(KILO_QUIT_TIMES)
+{
+  if (!m_term->getWindowSize(m_screenrows, m_screencols))
     terminal_manager::die("getWindowSize");
 
   m_screenrows -= 2;
+
+  for (std::size_t i = 0; i < m_sgr.size(); ++i)
+  {
+    const auto hl = static_cast<EditorHighlight>(i);
+    m_sgr[i] = hl == EditorHighlight::NORMAL
+                   ? "\x1b[39m"
+                   : "\x1b[" + std::to_string(convertSyntaxToColor(hl)) + "m";
+  }
+
+  switchBuffer(addBuffer());
 }
 
-/*** syntax highlighting ***/
+/*** buffers ***/
+
+std::size_t Editor::addBuffer()
+{
+  auto buffer = std::make_unique<Buffer>(KILO_UNDO_MEMORY_LIMIT);
+  buffer->version = ++m_next_version;
+
+  // rows loaded lazily from the file get their tabs indexed on first
+  // access; highlighting is deferred until the row is drawn
+  buffer->rows.setMaterializer([this](EditorRow &erow)
+                               { indexTabs(erow); });
+
+  m_buffers.push_back(std::move(buffer));
+  return m_buffers.size() - 1;
+}
 
-bool isSeparator(int c)
+void Editor::switchBuffer(std::size_t index)
 {
-  return std::isspace(c) || c == '\0' || std::strchr(",.()+-/*=~%<>[];", c) != NULL;
+  m_current = index;
+  m_buf = m_buffers[index].get();
+  m_search_hl = {-1, 0, 0};
+  // the other buffer's lines are not a scrolled copy of these
+  m_shadow_top = screenTop();
+  m_redraw = true;
+
+  if (m_buffers.size() > 1)
+    setStatusMessage("Buffer %zu/%zu: %s", index + 1, m_buffers.size(),
+                     m_buf->filename.empty() ? "[No Name]" : m_buf->filename.c_str());
 }
 
-bool isSLCommentStarted(EditorRow &erow, const std::string &comment_start_kw, std::size_t pos)
+// Opens a file in a buffer of its own, or switches to the buffer already
+// holding it. An untouched empty buffer is reused.
+void Editor::openBuffer(const std::string &filename)
 {
-  if (!erow.rendered.compare(pos, comment_start_kw.size(), comment_start_kw))
+  std::error_code ec;
+  const auto path = std::filesystem::weakly_canonical(filename, ec);
+  for (std::size_t i = 0; i < m_buffers.size(); ++i)
   {
-    std::fill(
-        erow.hl.begin() + pos,
-        erow.hl.end(),
-        EditorHighlight::COMMENT);
-    return true;
+    const auto &other = m_buffers[i]->filename;
+    if (other == filename || (!ec && !other.empty() && std::filesystem::weakly_canonical(other, ec) == path))
+    {
+      switchBuffer(i);
+      return;
+    }
+  }
+
+  const bool pristine = m_buf->filename.empty() && !m_buf->dirty && m_buf->rows.empty();
+  if (!pristine)
+  {
+    const auto index = addBuffer();
+    m_buffers[index]->filename = filename;
+    switchBuffer(index);
   }
-  return false;
+
+  open(filename.c_str());
 }
 
-bool isMLCommentStarted(EditorRow &erow, const std::string &comment_start_kw, std::size_t pos)
+void Editor::closeBuffer()
 {
-  if (!erow.rendered.compare(pos, comment_start_kw.size(), comment_start_kw))
+  m_buf->journal.discard();
+  m_buffers.erase(m_buffers.begin() + m_current);
+  if (m_buffers.empty())
+    addBuffer();
+
+  switchBuffer(std::min(m_current, m_buffers.size() - 1));
+  if (m_buffers.size() == 1)
+    setStatusMessage("Buffer closed");
+}
+
+bool Editor::anyBufferDirty() const
+{
+  return std::any_of(m_buffers.begin(), m_buffers.end(), [](const auto &buffer)
+                     { return buffer->dirty != 0; });
+}
+
+Buffer &Editor::currentBuffer()
+{
+  return *m_buf;
+}
+
+/*** memory ***/
+
+// What every buffer has taken from the system for its rows, their indexes
+// and its undo log; cheap enough to check before every frame.
+std::size_t Editor::memoryInUse() const
+{
+  std::size_t bytes = 0;
+  for (const auto &buffer : m_buffers)
+    bytes += buffer->rows.memoryStats().bytes_reserved + buffer->rows.indexBytes() +
+             buffer->hl_comment_index.capacity() + buffer->undo.memoryUsage();
+  return bytes;
+}
+
+// Keeps memoryInUse() under m_memory_budget where dropping derived data can:
+// the tab positions and highlight spans of rows more than
+// KILO_EVICT_MARGIN_ROWS from a buffer's view go, as does its comment-state
+// index, and all of it comes back as the rows are reached again. A row
+// arena with more than a sixteenth of the budget and a quarter of itself
+// free in its pools is rebuilt so that memory goes back to the system. Text, line indexes and
+// history are never dropped, so once they alone fill the budget it is only
+// tried again after another sixteenth of it has been used.
+void Editor::enforceMemoryBudget()
+{
+  if (!m_memory_budget)
+    return;
+
+  const auto in_use = memoryInUse();
+  if (in_use <= std::max(m_memory_budget, m_evicted_at + m_memory_budget / 16))
+    return;
+
+  for (const auto &buffer : m_buffers)
   {
-    std::fill(
-        erow.hl.begin() + pos,
-        erow.hl.begin() + pos + comment_start_kw.size(),
-        EditorHighlight::ML_COMMENT);
-    return true;
+    const auto top = static_cast<std::size_t>(std::max(buffer->rowoff, 0));
+    buffer->rows.evictDerived(top > KILO_EVICT_MARGIN_ROWS ? top - KILO_EVICT_MARGIN_ROWS : 0,
+                              top + m_screenrows + KILO_EVICT_MARGIN_ROWS);
+    buffer->hl_comment_index = std::vector<uint8_t>();
+    buffer->hl_index_valid = 0;
+
+    const auto stats = buffer->rows.memoryStats();
+    const auto idle = stats.bytes_reserved - stats.bytes_in_use;
+    if (idle > m_memory_budget / 16 && idle > stats.bytes_reserved / 4)
+      buffer->rows.compact();
   }
-  return false;
+#ifdef __GLIBC__
+  // the arenas go back to malloc, which keeps freed chunks unless asked
+  malloc_trim(0);
+#endif
+  m_evicted_at = memoryInUse();
 }
 
-bool isMLCommentEnded(EditorRow &erow, const std::string &comment_end_kw, std::size_t pos)
+void Editor::showMemoryUsage()
 {
-  if (!erow.rendered.compare(pos, comment_end_kw.size(), comment_end_kw))
+  RowMemory rows;
+  std::size_t undo = 0;
+  for (const auto &buffer : m_buffers)
   {
-    std::fill(
-        erow.hl.begin() + pos,
-        erow.hl.begin() + pos + comment_end_kw.size(),
-        EditorHighlight::ML_COMMENT);
-    return true;
+    const auto memory = buffer->rows.memoryUsage();
+    rows.text += memory.text;
+    rows.tabs += memory.tabs;
+    rows.hl += memory.hl;
+    rows.nodes += memory.nodes;
+    rows.index += memory.index + buffer->hl_comment_index.capacity();
+    undo += buffer->undo.memoryUsage();
   }
-  return false;
+  const auto held = memoryInUse();
+
+  const auto mib = [](std::size_t bytes)
+  { return bytes / static_cast<double>(1 << 20); };
+  const auto budget = m_memory_budget ? std::to_string(m_memory_budget >> 20) + "M" : std::string("none");
+  setStatusMessage("MiB: text %.1f tabs %.1f hl %.1f tree %.1f index %.1f undo %.1f | held %.1f budget %s",
+                   mib(rows.text), mib(rows.tabs), mib(rows.hl), mib(rows.nodes), mib(rows.index),
+                   mib(undo), mib(held), budget.c_str());
 }
 
-void Editor::updateSyntax(EditorRow &erow)
+/*** syntax highlighting ***/
+
+void Editor::updateSyntax(EditorRow &erow, bool in_comment)
 {
-  erow.hl.resize(erow.rendered.size(), EditorHighlight::NORMAL);
+  Profiler::Timer timer(m_profiler, Profiler::UPDATE_SYNTAX);
 
-  if (!m_syntax)
+  erow.hl_start_comment = in_comment;
+  erow.hl_valid = true;
+
+  if (!m_buf->syntax)
+  {
+    erow.hl.clear();
+    erow.hl_open_comment = false;
     return;
+  }
 
-  const auto &keywords = m_syntax->keywords;
-  const auto &scs = m_syntax->singleline_comment_start;
-  const auto &mcs = m_syntax->multiline_comment_start;
-  const auto &mce = m_syntax->multiline_comment_end;
+  erow.hl_open_comment = highlightRow(*m_buf->syntax, erow.row, in_comment, erow.hl);
+}
+
+void Editor::invalidateSyntax(int yindex)
+{
+  m_buf->hl_stale_from = std::min(m_buf->hl_stale_from, yindex);
+  m_buf->hl_index_valid = std::min(m_buf->hl_index_valid, yindex);
+  m_buf->version = ++m_next_version;
+}
 
-  bool prev_sep = true;
-  int in_string = 0;
-  bool in_comment = (erow.idx > 0 && m_rows[erow.idx - 1].hl_open_comment);
+// Brings highlighting up to date for every row up to `last`. Rows before
+// m_buf->hl_stale_from are known to be current; from there on each row is
+// re-highlighted only if its text changed or the comment state it was
+// computed from no longer matches the row above, so a flipped comment
+// state costs one pass over the rows that are actually about to be shown.
+//
+// At most KILO_HL_SYNC_ROWS rows are re-highlighted inline; the rest is
+// handed to the background worker. A view more than a worker batch past
+// the highlighted prefix is highlighted on its own instead.
+void Editor::ensureSyntax(int last)
+{
+  last = std::min(last, static_cast<int>(m_buf->rows.size()) - 1);
 
-  std::size_t i = 0;
-  while (i < erow.rendered.size())
+  if (m_buf->syntax && m_buf->rowoff - m_buf->hl_stale_from > KILO_HL_BATCH_ROWS)
   {
-    const auto c = erow.rendered[i];
-    EditorHighlight prev_hl = i > 0 ? erow.hl[i - 1] : EditorHighlight::NORMAL;
+    highlightWindow(m_buf->rowoff, last);
+    return;
+  }
 
-    if (!scs.empty() && !in_string && !in_comment)
+  // rows of the prefix whose spans were evicted are redone from the state
+  // they were computed from, which is still current
+  if (m_buf->syntax)
+  {
+    for (int y = std::max(m_buf->rowoff, 0); y < std::min(m_buf->hl_stale_from, last + 1); ++y)
     {
-      if (isSLCommentStarted(erow, scs, i))
-        break;
+      auto &erow = m_buf->rows[y];
+      if (!erow.hl_valid)
+        updateSyntax(erow, erow.hl_start_comment);
     }
+  }
+
+  // without a syntax rows highlight independently; only the visible ones matter
+  int y = m_buf->syntax ? std::min(m_buf->hl_stale_from, last + 1) : std::max(m_buf->rowoff, 0);
+  bool in_comment = m_buf->syntax && y > 0 && m_buf->rows[y - 1].hl_open_comment;
+  int budget = KILO_HL_SYNC_ROWS;
 
-    if (!mcs.empty() && !mce.empty() && !in_string)
+  for (; y <= last; ++y)
+  {
+    auto &erow = m_buf->rows[y];
+    if (!erow.hl_valid || erow.hl_start_comment != in_comment)
     {
-      if (in_comment)
+      if (m_buf->syntax && budget-- == 0)
       {
-        erow.hl[i] = EditorHighlight::ML_COMMENT;
-        if (isMLCommentEnded(erow, mce, i))
-        {
-          i += mce.size();
-          in_comment = false;
-          prev_sep = true;
-        }
-        else
-        {
-          i++;
-        }
-        continue;
-      }
-      else if (isMLCommentStarted(erow, mcs, i))
-      {
-        i += mcs.size();
-        in_comment = true;
-        continue;
+        // rows from here on are drawn plain until the worker catches up
+        m_buf->hl_stale_from = y;
+        scheduleSyntax(y, last, in_comment);
+        return;
       }
+      updateSyntax(erow, in_comment);
     }
 
-    if (m_syntax->flags & HL_HIGHLIGHT_STRINGS)
-    {
-      if (in_string)
-      {
-        erow.hl[i] = EditorHighlight::STRING;
+    in_comment = erow.hl_open_comment;
+  }
 
-        if (c == '\\' && i + 1 < erow.rendered.size())
-        {
-          erow.hl[i + 1] = EditorHighlight::STRING;
-          i += 2;
-          continue;
-        }
+  if (m_buf->syntax)
+    m_buf->hl_stale_from = std::max(m_buf->hl_stale_from, last + 1);
+}
 
-        if (c == in_string)
-          in_string = 0;
+void Editor::scheduleSyntax(int first, int last, bool in_comment)
+{
+  // the worker already has this snapshot
+  if (m_buf->hl_job_version == m_buf->version && m_buf->hl_job_row == first)
+    return;
 
-        prev_sep = true;
-        i++;
-        continue;
-      }
-      else
-      {
-        if (c == '"' || c == '\'')
-        {
-          in_string = c;
-          erow.hl[i] = EditorHighlight::STRING;
-          i++;
-          continue;
-        }
-      }
-    }
+  HighlightJob job;
+  job.version = m_buf->version;
+  job.first_row = first;
+  job.in_comment = in_comment;
+  job.syntax = m_buf->syntax;
 
-    if (m_syntax->flags & HL_HIGHLIGHT_NUMBERS)
-    {
-      if ((std::isdigit(c) && (prev_sep || prev_hl == EditorHighlight::NUMBER)) ||
-          (c == '.' && prev_hl == EditorHighlight::NUMBER))
-      {
-        erow.hl[i] = EditorHighlight::NUMBER;
-        prev_sep = false;
-        i++;
-        continue;
-      }
-    }
+  last = std::min(last, first + KILO_HL_BATCH_ROWS - 1);
+  job.text.reserve(last - first + 1);
+  for (int y = first; y <= last; ++y)
+    job.text.emplace_back(m_buf->rows[y].row);
+
+  m_buf->hl_job_version = m_buf->version;
+  m_buf->hl_job_row = first;
+  m_syntax_worker.submit(std::move(job));
+}
 
-    if (prev_sep)
+// Brings m_buf->hl_comment_index up to row `target`. The rows past what is
+// known are cut into chunks highlighted in parallel, each assuming it
+// starts outside a comment; a sequential sweep then redoes a chunk that
+// was entered inside one, up to the first row whose state comes out the
+// same, since every row after it would too.
+void Editor::indexCommentStates(int target)
+{
+  auto &index = m_buf->hl_comment_index;
+  if (m_buf->hl_index_valid >= target)
+    return;
+
+  if (index.size() < static_cast<std::size_t>(target))
+    index.resize(target);
+
+  // the highlighted prefix already knows its states
+  int y = m_buf->hl_index_valid;
+  for (; y < std::min(m_buf->hl_stale_from, target); ++y)
+    index[y] = m_buf->rows[y].hl_open_comment;
+
+  const auto &syntax = *m_buf->syntax;
+  const auto &rows = m_buf->rows;
+  const auto first = static_cast<std::size_t>(y);
+  const auto count = static_cast<std::size_t>(target) - first;
+  auto &pool = ThreadPool::shared();
+  const auto chunks = std::max<std::size_t>(
+      1, std::min<std::size_t>(count / KILO_HL_INDEX_GRAIN, pool.concurrency() * 4));
+  const auto chunkStart = [&](std::size_t chunk)
+  { return first + count * chunk / chunks; };
+  const bool entry = first > 0 && index[first - 1];
+
+  pool.parallelFor(chunks, 1, [&](std::size_t begin, std::size_t end)
+                   {
+                     std::pmr::vector<HighlightSpan> spans;
+                     for (auto chunk = begin; chunk < end; ++chunk)
+                     {
+                       bool in_comment = chunk == 0 && entry;
+                       rows.forEachLine(chunkStart(chunk), chunkStart(chunk + 1),
+                                        [&](std::size_t line, std::string_view text)
+                                        {
+                                          in_comment = highlightRow(syntax, text, in_comment, spans);
+                                          index[line] = in_comment;
+                                        });
+                     }
+                   });
+
+  std::pmr::vector<HighlightSpan> spans;
+  for (std::size_t chunk = 1; chunk < chunks; ++chunk)
+  {
+    const auto begin = chunkStart(chunk), end = chunkStart(chunk + 1);
+    bool in_comment = index[begin - 1];
+    if (!in_comment)
+      continue;
+
+    for (auto line = begin; line < end; ++line)
     {
-      auto kwitr = keywords.begin();
-      for (; kwitr != keywords.end(); ++kwitr)
-      {
-        auto kw = *kwitr;
-        int klen = kw.size();
-        bool is_kw2 = kw[klen - 1] == '|';
-        if (is_kw2)
-          kw = kw.substr(0, --klen);
-
-        if (!erow.rendered.compare(i, klen, kw) &&
-            isSeparator(erow.rendered[i + klen]))
-        {
-          std::fill(
-              erow.hl.begin() + i,
-              erow.hl.begin() + i + klen,
-              is_kw2 ? EditorHighlight::KEYWORD2 : EditorHighlight::KEYWORD1);
-          i += klen;
-          break;
-        }
-      }
-      if (kwitr != keywords.end())
-      {
-        prev_sep = false;
-        continue;
-      }
+      in_comment = highlightRow(syntax, rows.lineAt(line), in_comment, spans);
+      if (in_comment == static_cast<bool>(index[line]))
+        break;
+      index[line] = in_comment;
     }
+  }
+
+  m_buf->hl_index_valid = target;
+}
+
+// Highlights rows `first` to `last` from the comment state the index has
+// for the row above, leaving the highlighted prefix where it is.
+void Editor::highlightWindow(int first, int last)
+{
+  indexCommentStates(first);
+
+  bool in_comment = first > 0 && m_buf->hl_comment_index[first - 1];
+  for (int y = first; y <= last; ++y)
+  {
+    auto &erow = m_buf->rows[y];
+    if (!erow.hl_valid || erow.hl_start_comment != in_comment)
+      updateSyntax(erow, in_comment);
+    in_comment = erow.hl_open_comment;
+  }
+
+  m_buf->hl_window_first = first;
+  m_buf->hl_window_last = last;
+  m_buf->hl_window_version = m_buf->version;
+}
+
+// Installs highlighting computed by the worker, provided the buffer has not
+// changed since the snapshot and the result continues the highlighted prefix.
+bool Editor::applySyntaxResults()
+{
+  HighlightResult result;
+  if (!m_syntax_worker.take(result))
+    return false;
+
+  m_buf->hl_job_row = -1;
+  if (result.version != m_buf->version || result.first_row != m_buf->hl_stale_from)
+  {
+    // the rows it was for are still stale; ask again from where they start,
+    // unless the view is so far past them that ensureSyntax() does it alone
+    const int first = m_buf->hl_stale_from;
+    const int last = std::min(m_buf->rowoff + m_screenrows, static_cast<int>(m_buf->rows.size())) - 1;
+    if (m_buf->syntax && !m_view && first <= last && m_buf->rowoff - first <= KILO_HL_BATCH_ROWS)
+      scheduleSyntax(first, last, first > 0 && m_buf->rows[first - 1].hl_open_comment);
+    return false;
+  }
 
-    prev_sep = isSeparator(c);
-    i++;
+  bool in_comment = result.in_comment;
+  for (std::size_t i = 0; i < result.hl.size(); ++i)
+  {
+    auto &erow = m_buf->rows[result.first_row + i];
+    erow.hl = std::move(result.hl[i]);
+    erow.hl_start_comment = in_comment;
+    erow.hl_open_comment = result.open_comment[i];
+    erow.hl_valid = true;
+    in_comment = erow.hl_open_comment;
   }
 
-  bool is_changed = erow.hl_open_comment != in_comment;
-  erow.hl_open_comment = in_comment;
-  if (is_changed && erow.idx + 1 < static_cast<int>(m_rows.size()))
-    updateSyntax(m_rows[erow.idx + 1]);
+  m_buf->hl_stale_from += static_cast<int>(result.hl.size());
+  return true;
 }
 
 int Editor::convertSyntaxToColor(EditorHighlight hl)
@@ -262,245 +480,489 @@ int Editor::convertSyntaxToColor(EditorHighlight hl)
 
 void Editor::selectSyntaxHighlight()
 {
-  m_syntax = nullptr;
-  if (m_filename.empty())
-    return;
+  m_buf->hl_stale_from = 0;
+  m_buf->hl_index_valid = 0;
+  m_buf->version = ++m_next_version;
+  m_buf->rows.forEachMaterialized([](EditorRow &erow)
+                                  { erow.hl_valid = false; });
 
-  const auto ext = m_filename.rfind('.');
+  m_buf->syntax = m_buf->filename.empty() ? nullptr : findSyntax(m_buf->filename);
+}
+
+/*** row operations ***/
 
-  for (const auto &syntax : HLDB)
+namespace
+{
+  // Rendered column reached after the first `cx` bytes of a row that is
+  // not plain ASCII.
+  int utf8CxToRx(std::string_view row, std::size_t cx)
   {
-    for (const auto &fm : syntax.filematch)
+    int rx = 0;
+    for (std::size_t i = 0; i < cx && i < row.size();)
     {
-      int is_ext = (fm[0] == '.');
-      if ((is_ext && ext != std::string::npos && !m_filename.compare(ext, fm.size(), fm)) ||
-          (!is_ext && m_filename.find(fm) != std::string::npos))
+      if (row[i] == '\t')
       {
-        m_syntax = std::make_shared<EditorSyntax>(syntax);
+        rx += KILO_TAB_STOP - (rx % KILO_TAB_STOP);
+        i++;
+        continue;
+      }
 
-        for (auto &row : m_rows)
-          updateSyntax(row);
+      const auto c = utf8::cluster(row, i);
+      rx += c.width;
+      i = c.end;
+    }
+    return rx;
+  }
 
-        return;
+  int utf8RxToCx(std::string_view row, int rx)
+  {
+    int at = 0;
+    for (std::size_t i = 0; i < row.size();)
+    {
+      int width = KILO_TAB_STOP - (at % KILO_TAB_STOP);
+      std::size_t end = i + 1;
+      if (row[i] != '\t')
+      {
+        const auto c = utf8::cluster(row, i);
+        width = c.width;
+        end = c.end;
       }
+
+      if (rx < at + width)
+        return static_cast<int>(i);
+      at += width;
+      i = end;
     }
+    return static_cast<int>(row.size());
   }
-}
 
-/*** row operations ***/
+  // Rendered column of raw column `cx`; in an ASCII row only the tabs
+  // before it widen it.
+  int rowCxToRx(const EditorRow &erow, int cx)
+  {
+    if (!erow.ascii)
+      return utf8CxToRx(erow.row, cx);
 
-void Editor::convertRowCxToRx(EditorRow &erow)
-{
-  int rx = 0;
-  for (int i = 0; i < m_cx; ++i)
+    int extra = 0;
+    for (const auto tab : erow.tabs)
+    {
+      if (static_cast<int>(tab) >= cx)
+        break;
+      const int tab_rx = static_cast<int>(tab) + extra;
+      extra += (KILO_TAB_STOP - 1) - (tab_rx % KILO_TAB_STOP);
+    }
+    return cx + extra;
+  }
+
+  // Columns `line` takes once its tabs are expanded.
+  std::size_t renderedWidth(std::string_view line)
+  {
+    if (!utf8::isAscii(line))
+      return utf8CxToRx(line, line.size());
+
+    std::size_t rx = 0, from = 0;
+    for (auto tab = line.find('\t'); tab != std::string_view::npos; tab = line.find('\t', from))
+    {
+      rx += tab - from;
+      rx += KILO_TAB_STOP - (rx % KILO_TAB_STOP);
+      from = tab + 1;
+    }
+    return rx + (line.size() - from);
+  }
+
+  // Raw column covering rendered column `rx`, or the row's length past its end.
+  int rowRxToCx(const EditorRow &erow, int rx)
   {
-    if (erow.row[i] == '\t')
-      rx += (KILO_TAB_STOP - 1) - (rx % KILO_TAB_STOP);
-    rx++;
+    if (!erow.ascii)
+      return utf8RxToCx(erow.row, rx);
+
+    int extra = 0;
+    for (const auto tab : erow.tabs)
+    {
+      const int tab_rx = static_cast<int>(tab) + extra;
+      if (rx < tab_rx)
+        break;
+
+      const int width = KILO_TAB_STOP - (tab_rx % KILO_TAB_STOP);
+      if (rx < tab_rx + width)
+        return static_cast<int>(tab);
+      extra += width - 1;
+    }
+    return std::min(rx - extra, static_cast<int>(erow.row.size()));
   }
-  m_rx = rx;
+}
+
+void Editor::convertRowCxToRx(EditorRow &erow)
+{
+  m_rx = rowCxToRx(erow, m_buf->cx);
 }
 
 int Editor::convertRowRxToCx(EditorRow &erow, int rx)
 {
-  int cur_rx = 0, cx = 0;
-  for (cx = 0; cx < static_cast<int>(erow.row.size()); ++cx)
-  {
-    if (erow.row[cx] == '\t')
-      cur_rx += (KILO_TAB_STOP - 1) - (cur_rx % KILO_TAB_STOP);
+  return rowRxToCx(erow, rx);
+}
 
-    cur_rx++;
+void Editor::indexTabs(EditorRow &erow)
+{
+  erow.tabs.clear();
+  const char *data = erow.row.data();
+  const char *end = data + erow.row.size();
+  for (const char *p = data; (p = static_cast<const char *>(std::memchr(p, '\t', end - p))); ++p)
+    erow.tabs.push_back(static_cast<uint32_t>(p - data));
+
+  erow.ascii = utf8::isAscii(erow.row);
+  erow.hl_valid = false;
+}
 
-    if (cur_rx > rx)
-      return cx;
-  }
+void Editor::updateRow(int yindex)
+{
+  Profiler::Timer timer(m_profiler, Profiler::UPDATE_ROW);
 
-  return cx;
+  indexTabs(m_buf->rows[yindex]);
+  m_buf->rows.rewrap(yindex);
+  invalidateSyntax(yindex);
 }
 
-void Editor::updateRow(EditorRow &erow)
+// Logs an edit for undo and makes it.
+void Editor::edit(UndoLog::Op op, int yindex, int xindex, std::string_view text)
 {
-  std::string render = "";
-  for (const auto &c : erow.row)
+  m_buf->undo.record(op, yindex, xindex, text);
+  applyEdit(op, yindex, xindex, text);
+}
+
+void Editor::applyEdit(UndoLog::Op op, int yindex, int xindex, std::string_view text)
+{
+  m_buf->journal.append(op, yindex, xindex, text);
+
+  switch (op)
   {
-    if (c == '\t')
-    {
-      render += " ";
-      while (render.size() % KILO_TAB_STOP != 0)
-        render += " ";
-    }
-    else
-    {
-      render += c;
-    }
+  case UndoLog::Op::INSERT_CHARS:
+    m_buf->rows[yindex].row.insert(xindex, text);
+    updateRow(yindex);
+    break;
+  case UndoLog::Op::DELETE_CHARS:
+    m_buf->rows[yindex].row.erase(xindex, text.size());
+    updateRow(yindex);
+    break;
+  case UndoLog::Op::INSERT_ROW:
+  {
+    EditorRow erow;
+    erow.row = text;
+    m_buf->rows.insert(yindex, std::move(erow));
+    updateRow(yindex);
+  }
+  break;
+  case UndoLog::Op::DELETE_ROW:
+    m_buf->rows.erase(yindex);
+    invalidateSyntax(yindex);
+    break;
+  case UndoLog::Op::SPLIT_ROW:
+  {
+    // rows live in tree nodes, so this reference survives the insert
+    auto &erow = m_buf->rows[yindex];
+    EditorRow next;
+    next.row = std::string_view(erow.row).substr(xindex);
+    m_buf->rows.insert(yindex + 1, std::move(next));
+    erow.row.resize(xindex);
+    updateRow(yindex);
+    updateRow(yindex + 1);
+  }
+  break;
+  case UndoLog::Op::JOIN_ROWS:
+  {
+    auto &erow = m_buf->rows[yindex];
+    erow.row += m_buf->rows[yindex + 1].row;
+    m_buf->rows.erase(yindex + 1);
+    updateRow(yindex);
+  }
+  break;
   }
 
-  render += "\0";
-  erow.rendered = render;
-  updateSyntax(erow);
+  m_buf->dirty++;
 }
 
-bool Editor::insertRow(int yindex, const std::string &s)
+// Whether an edit read back from a swap file can be made to the rows as
+// they are.
+bool Editor::editFits(UndoLog::Op op, int yindex, int xindex, std::string_view text)
 {
-  if (yindex < 0 || yindex > static_cast<int>(m_rows.size()))
+  const int rows = static_cast<int>(m_buf->rows.size());
+  if (yindex < 0 || xindex < 0 || yindex > rows)
+    return false;
+
+  if (op == UndoLog::Op::INSERT_ROW)
+    return true;
+  if (yindex == rows)
     return false;
 
-  m_rows.insert(m_rows.begin() + yindex, EditorRow(yindex));
-  m_rows[yindex].row = s;
-  m_rows[yindex].idx = yindex;
-  std::for_each(m_rows.begin() + yindex + 1, m_rows.end(), [](auto &erow)
-                { erow.idx++; });
+  const std::string_view row = m_buf->rows[yindex].row;
+  switch (op)
+  {
+  case UndoLog::Op::INSERT_CHARS:
+  case UndoLog::Op::SPLIT_ROW:
+    return static_cast<std::size_t>(xindex) <= row.size();
+  case UndoLog::Op::DELETE_CHARS:
+    return row.substr(std::min<std::size_t>(xindex, row.size()), text.size()) == text;
+  case UndoLog::Op::DELETE_ROW:
+    return row == text;
+  case UndoLog::Op::JOIN_ROWS:
+    return yindex + 1 < rows && static_cast<std::size_t>(xindex) == row.size();
+  case UndoLog::Op::INSERT_ROW:
+    break;
+  }
+  return true;
+}
 
-  updateRow(m_rows[yindex]);
-  m_dirty++;
+bool Editor::insertRow(int yindex, std::string_view s)
+{
+  if (yindex < 0 || yindex > static_cast<int>(m_buf->rows.size()))
+    return false;
 
+  edit(UndoLog::Op::INSERT_ROW, yindex, 0, s);
   return true;
 }
 
 void Editor::deleteRow(int yindex)
 {
-  if (yindex < 0 || yindex >= static_cast<int>(m_rows.size()))
+  if (yindex < 0 || yindex >= static_cast<int>(m_buf->rows.size()))
     return;
 
-  m_rows.erase(m_rows.begin() + yindex);
-  std::for_each(m_rows.begin() + yindex, m_rows.end(), [](auto &erow)
-                { erow.idx--; });
+  edit(UndoLog::Op::DELETE_ROW, yindex, 0, m_buf->rows[yindex].row);
+}
+
+void Editor::splitRow(int yindex, int xindex)
+{
+  edit(UndoLog::Op::SPLIT_ROW, yindex, xindex, {});
+}
 
-  m_dirty++;
+void Editor::joinRows(int yindex)
+{
+  edit(UndoLog::Op::JOIN_ROWS, yindex, static_cast<int>(m_buf->rows[yindex].row.size()), {});
 }
 
-void Editor::insertCharIntoRow(EditorRow &erow, int yindex, int c)
+void Editor::insertCharIntoRow(int yindex, int xindex, int c)
 {
-  if (yindex < 0 || yindex > static_cast<int>(erow.row.size()))
-    yindex = erow.row.size();
+  auto &erow = m_buf->rows[yindex];
+  if (xindex < 0 || xindex > static_cast<int>(erow.row.size()))
+    xindex = erow.row.size();
 
-  erow.row.insert(yindex, 1, c);
-  updateRow(erow);
-  m_dirty++;
+  const char ch = static_cast<char>(c);
+  edit(UndoLog::Op::INSERT_CHARS, yindex, xindex, std::string_view(&ch, 1));
 }
 
-void Editor::appendStringToRow(EditorRow &erow, const std::string &s)
+void Editor::insertStringIntoRow(int yindex, int xindex, std::string_view s)
 {
-  erow.row += s;
-  updateRow(erow);
-  m_dirty++;
+  edit(UndoLog::Op::INSERT_CHARS, yindex, xindex, s);
 }
 
-void Editor::deleteCharFromRow(EditorRow &erow, int xindex)
+void Editor::deleteCharFromRow(int yindex, int xindex)
 {
+  auto &erow = m_buf->rows[yindex];
   if (xindex < 0 || xindex >= static_cast<int>(erow.row.size()))
     return;
 
-  erow.row.erase(xindex, 1);
-  updateRow(erow);
-  m_dirty++;
+  // the whole character, however many bytes it takes
+  const std::size_t end = erow.ascii ? xindex + 1 : utf8::cluster(erow.row, xindex).end;
+  const std::string text(std::string_view(erow.row).substr(xindex, end - xindex));
+  edit(UndoLog::Op::DELETE_CHARS, yindex, xindex, text);
 }
 
 /*** editor operations ***/
 
 void Editor::insertChar(int c)
 {
-  if (m_cy == static_cast<int>(m_rows.size()))
-    insertRow(m_cy, "");
+  m_buf->undo.begin(UndoLog::Kind::TYPING, {m_buf->cx, m_buf->cy});
+
+  if (m_buf->cy == static_cast<int>(m_buf->rows.size()))
+    insertRow(m_buf->cy, "");
+
+  insertCharIntoRow(m_buf->cy, m_buf->cx, c);
+  m_buf->cx++;
 
-  insertCharIntoRow(m_rows[m_cy], m_cx, c);
-  m_cx++;
+  m_buf->undo.end({m_buf->cx, m_buf->cy});
 }
 
 void Editor::insertNewline()
 {
-  if (m_cx == 0)
-    insertRow(m_cy, "");
+  m_buf->undo.begin(UndoLog::Kind::OTHER, {m_buf->cx, m_buf->cy});
+
+  if (m_buf->cx == 0)
+    insertRow(m_buf->cy, "");
   else
-  {
-    // Note:
-    // when inserting newline with insertRow(), the vector of m_row will reallocate its memory,
-    // then the reference to m_rows will become invalid.
-    // In order to avoid this, we need to reserve memory accounting for the new row.
-    m_rows.reserve(m_rows.size() + 1);
+    splitRow(m_buf->cy, m_buf->cx);
+
+  m_buf->cy++;
+  m_buf->cx = 0;
 
-    auto &erow = m_rows[m_cy];
-    if (insertRow(m_cy + 1, erow.row.substr(m_cx)))
+  m_buf->undo.end({m_buf->cx, m_buf->cy});
+}
+
+// Inserts a block of text at the cursor as one edit, splitting it into
+// rows at CR, LF or CRLF, and leaves the cursor after it.
+void Editor::insertText(std::string_view text)
+{
+  if (text.empty())
+    return;
+
+  m_buf->undo.begin(UndoLog::Kind::OTHER, {m_buf->cx, m_buf->cy});
+
+  if (m_buf->cy == static_cast<int>(m_buf->rows.size()))
+    insertRow(m_buf->cy, "");
+
+  std::size_t pos = 0;
+  while (true)
+  {
+    const auto nl = text.find_first_of("\r\n", pos);
+    const auto line = text.substr(pos, nl == std::string_view::npos ? std::string_view::npos : nl - pos);
+    if (!line.empty())
     {
-      erow.row = erow.row.substr(0, m_cx);
-      updateRow(erow);
+      insertStringIntoRow(m_buf->cy, m_buf->cx, line);
+      m_buf->cx += static_cast<int>(line.size());
     }
+
+    if (nl == std::string_view::npos)
+      break;
+
+    pos = nl + 1;
+    if (text[nl] == '\r' && pos < text.size() && text[pos] == '\n')
+      pos++;
+
+    // what followed the cursor moves down with every line break
+    splitRow(m_buf->cy, m_buf->cx);
+    m_buf->cy++;
+    m_buf->cx = 0;
   }
 
-  m_cy++;
-  m_cx = 0;
+  m_buf->undo.end({m_buf->cx, m_buf->cy});
 }
 
 void Editor::deleteChar()
 {
-  if (m_cy == static_cast<int>(m_rows.size()))
+  if (m_buf->cy == static_cast<int>(m_buf->rows.size()))
     return;
 
-  if (m_cx == 0 && m_cy == 0)
+  if (m_buf->cx == 0 && m_buf->cy == 0)
     return;
 
-  auto &erow = m_rows[m_cy];
-  if (m_cx > 0)
+  m_buf->undo.begin(UndoLog::Kind::DELETING, {m_buf->cx, m_buf->cy});
+
+  if (m_buf->cx > 0)
   {
-    deleteCharFromRow(erow, m_cx - 1);
-    m_cx--;
+    const auto &erow = m_buf->rows[m_buf->cy];
+    const int start = erow.ascii ? m_buf->cx - 1 : static_cast<int>(utf8::clusterStart(erow.row, m_buf->cx - 1));
+    deleteCharFromRow(m_buf->cy, start);
+    m_buf->cx = start;
   }
   else
   {
-    m_cx = static_cast<int>(m_rows[m_cy - 1].row.size());
-    appendStringToRow(m_rows[m_cy - 1], erow.row);
-    deleteRow(m_cy);
-    m_cy--;
+    m_buf->cx = static_cast<int>(m_buf->rows[m_buf->cy - 1].row.size());
+    joinRows(m_buf->cy - 1);
+    m_buf->cy--;
   }
+
+  m_buf->undo.end({m_buf->cx, m_buf->cy});
 }
 
-/*** file i/o ***/
+void Editor::undo()
+{
+  UndoLog::Cursor cursor;
+  const bool undone = m_buf->undo.undo([this](UndoLog::Op op, int yindex, int xindex, std::string_view text)
+                                  { applyEdit(op, yindex, xindex, text); },
+                                  cursor);
+  if (!undone)
+  {
+    setStatusMessage("Nothing to undo");
+    return;
+  }
+
+  m_buf->cx = cursor.cx;
+  m_buf->cy = cursor.cy;
+  if (m_buf->undo.atSavedPoint())
+    m_buf->dirty = 0;
+}
 
-std::string Editor::convertRowsToString()
+void Editor::redo()
 {
-  std::string s{};
-  for (const auto &row : m_rows)
-    s += row.row + '\n';
+  UndoLog::Cursor cursor;
+  const bool redone = m_buf->undo.redo([this](UndoLog::Op op, int yindex, int xindex, std::string_view text)
+                                  { applyEdit(op, yindex, xindex, text); },
+                                  cursor);
+  if (!redone)
+  {
+    setStatusMessage("Nothing to redo");
+    return;
+  }
 
-  return s;
+  m_buf->cx = cursor.cx;
+  m_buf->cy = cursor.cy;
+  if (m_buf->undo.atSavedPoint())
+    m_buf->dirty = 0;
 }
 
+/*** file i/o ***/
+
 void Editor::open(const char *filename)
 {
   if (!std::filesystem::exists(filename))
   {
+    // a viewer has nothing to show, and creates nothing
+    if (m_view)
+    {
+      errno = ENOENT;
+      terminal_manager::die(filename);
+    }
+
     std::ofstream file(filename);
     if (!file)
       terminal_manager::die("create a new file");
   }
 
-  m_filename = std::string(filename);
+  m_buf->filename = std::string(filename);
+
+  // only the newline index is built here; rows are materialized from the
+  // mapping when they are displayed or edited
+  auto source = FileSource::open(m_buf->filename, m_follow);
+  if (!source)
+    terminal_manager::die("mmap");
+
+  if (m_follow)
+    m_follow_source = source;
+  m_buf->rows.assign(std::move(source));
 
   selectSyntaxHighlight();
+  m_buf->undo.clear();
+  m_buf->dirty = 0;
 
-  std::ifstream file(filename);
-  if (!file.is_open())
-    terminal_manager::die("fopen");
+  if (m_batch || m_view)
+    return;
 
-  std::string line;
-  while (std::getline(file, line))
+  // edits a killed session left in the swap file are replayed onto the
+  // file as it is on disk
+  const auto recovery = m_buf->journal.open(m_buf->filename, [this](UndoLog::Op op, int yindex, int xindex, std::string_view text)
+                                            {
+                                              if (!editFits(op, yindex, xindex, text))
+                                                return false;
+                                              applyEdit(op, yindex, xindex, text);
+                                              return true; });
+  if (recovery.edits)
   {
-    while (line.size() && (line[line.size() - 1] == '\n' || line[line.size() - 1] == '\r'))
-      line.erase(line.size() - 1);
-
-    insertRow(m_rows.size(), line);
+    m_buf->undo.forgetSavedPoint();
+    setStatusMessage("Recovered %zu edits from %s; Ctrl-S keeps them",
+                     recovery.edits, Journal::swapPath(m_buf->filename).c_str());
+  }
+  else if (recovery.stale)
+  {
+    setStatusMessage("File changed since its swap file was written; kept it as %s.stale",
+                     Journal::swapPath(m_buf->filename).c_str());
   }
-
-  file.close();
-  m_dirty = 0;
 }
 
 void Editor::save()
 {
-  if (m_filename.empty())
+  const bool named = !m_buf->filename.empty();
+  if (!named)
   {
-    m_filename = fromPrompt("Save as: %s (ESC to cancel)");
-    if (m_filename.empty())
+    m_buf->filename = fromPrompt("Save as: %s (ESC to cancel)");
+    if (m_buf->filename.empty())
     {
       setStatusMessage("Save aborted");
       return;
@@ -508,279 +970,757 @@ void Editor::save()
     selectSyntaxHighlight();
   }
 
-  std::ofstream file(m_filename);
-  if (!file.is_open())
+  const auto started = std::chrono::steady_clock::now();
+
+  // Unmodified rows are still backed by the mapping of the original file,
+  // so it must not be truncated underneath them: lines are streamed into a
+  // sibling file straight from the buffer, which is then renamed over the
+  // original and leaves the mapped inode intact.
+  // Overwriting in place would clobber the mapping while it is read, so
+  // every row is copied out of it first and the file mapped again after.
+  AtomicFile file(m_buf->filename);
+  bool ok = file.open();
+  if (ok && file.inPlace())
+    m_buf->rows.materializeAll();
+  if (ok)
+  {
+    m_buf->rows.forEachLine([&](std::string_view line)
+                       { ok = ok && file.append(line) && file.append("\n"); });
+    ok = ok && file.commit();
+  }
+
+  if (!ok)
   {
     setStatusMessage("Can't save! I/O error: %s", std::strerror(errno));
-    terminal_manager::die("fopen");
+    return;
   }
 
-  std::string s = convertRowsToString();
-  file << s;
-  file.close();
-  m_dirty = 0;
-  setStatusMessage("%d bytes written to disk", s.size());
+  const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - started;
+  if (file.inPlace())
+  {
+    if (auto source = FileSource::open(m_buf->filename))
+    {
+      m_buf->rows.assign(std::move(source));
+      selectSyntaxHighlight();
+    }
+  }
+  m_buf->undo.markSaved();
+  if (named)
+    m_buf->journal.discard();
+  else if (!m_batch)
+    m_buf->journal.open(m_buf->filename, [](UndoLog::Op, int, int, std::string_view)
+                        { return false; });
+  m_buf->dirty = 0;
+  setStatusMessage("%zu bytes written to disk in %.1f ms", file.bytesWritten(), elapsed.count());
 }
 
 /*** find ***/
 
 void Editor::findCallback(std::string &query, int key)
 {
-  static int last_match = -1;
-  static int direction = 1;
-
-  static int saved_hl_line;
-  static std::vector<EditorHighlight> saved_hl;
+  Profiler::Timer timer(m_profiler, Profiler::FIND);
 
-  if (!saved_hl.empty())
-  {
-    std::copy(saved_hl.begin(), saved_hl.end(), m_rows[saved_hl_line].hl.begin());
-    saved_hl.clear();
-  }
+  m_search_hl.row = -1;
 
   if (key == '\r' || key == '\x1b')
   {
-    last_match = -1;
-    direction = 1;
+    m_search_has_match = false;
+    m_search_direction = 1;
+    m_search.clear();
+    m_search_status.clear();
     return;
   }
+  else if (key == CTRL_KEY('r'))
+  {
+    m_search_regex = !m_search_regex;
+    m_search_has_match = false;
+    m_search_direction = 1;
+  }
   else if (key == static_cast<int>(EditorKey::ARROW_RIGHT) ||
            key == static_cast<int>(EditorKey::ARROW_DOWN))
   {
-    direction = 1;
+    m_search_direction = 1;
   }
   else if (key == static_cast<int>(EditorKey::ARROW_LEFT) ||
            key == static_cast<int>(EditorKey::ARROW_UP))
   {
-    direction = -1;
+    m_search_direction = -1;
   }
   else
   {
-    last_match = -1;
-    direction = 1;
+    m_search_has_match = false;
+    m_search_direction = 1;
   }
 
-  if (last_match == -1)
-    direction = 1;
+  const auto mode = m_search_regex ? SearchMode::REGEX : SearchMode::LITERAL;
+  const auto &matches = m_search.update(m_buf->rows, m_buf->version, query, mode);
+
+  m_search_status = m_search_regex ? "regex | " : "";
+  if (!m_search.error().empty())
+    m_search_status += m_search.error() + " | ";
+  else if (!query.empty() && matches.empty())
+    m_search_status += "no matches | ";
 
-  int current = last_match;
+  if (matches.empty())
+    return;
 
-  for (auto &row : m_rows)
+  // a new query starts at the first match from where the search began,
+  // arrows step to the neighbouring match, wrapping around the buffer
+  auto it = matches.end();
+  if (!m_search_has_match)
+  {
+    it = std::lower_bound(matches.begin(), matches.end(), m_search_origin);
+  }
+  else if (m_search_direction == 1)
+  {
+    it = std::upper_bound(matches.begin(), matches.end(), m_search_last);
+  }
+  else
   {
-    current += direction;
-    if (current == -1)
-      current = m_rows.size() - 1;
-    else if (current == static_cast<int>(m_rows.size()))
-      current = 0;
+    it = std::lower_bound(matches.begin(), matches.end(), m_search_last);
+    it = it == matches.begin() ? matches.end() - 1 : it - 1;
+  }
+  if (it == matches.end())
+    it = matches.begin();
+
+  m_search_has_match = true;
+  m_search_last = *it;
+  m_search_status += std::to_string(it - matches.begin() + 1) + "/" +
+                     std::to_string(matches.size()) + " matches | ";
+
+  m_search_hl = *it;
+  m_buf->cy = it->row;
+  m_buf->cx = it->col;
+  m_buf->rowoff = m_buf->rows.size();
+}
 
-    const auto &render = row.rendered;
-    auto match_start_offset = render.find(query);
-    if (match_start_offset != std::string::npos)
+void Editor::find()
+{
+  int saved_cx = m_buf->cx;
+  int saved_cy = m_buf->cy;
+  int saved_coloff = m_buf->coloff;
+  int saved_rowoff = m_buf->rowoff;
+
+  m_search_origin = {m_buf->cy, m_buf->cx, 0};
+  m_search_status = m_search_regex ? "regex | " : "";
+
+  std::string query = fromPrompt("Search: %s (Use ESC/Arrows/Enter, ^R regex)", [this](std::string &query, int key)
+                                 { findCallback(query, key); });
+
+  m_search_status.clear();
+  m_search_hl.row = -1;
+
+  if (query.empty())
+  {
+    m_buf->cx = saved_cx;
+    m_buf->cy = saved_cy;
+    m_buf->coloff = saved_coloff;
+    m_buf->rowoff = saved_rowoff;
+  }
+}
+
+// Replaces every match of a list in buffer order with `with` in one pass
+// over the rows they are in, each rebuilt and re-indexed once. Every
+// replacement is logged as a delete and an insert into the undo group the
+// caller has open. A match overlapping the one before it is left alone;
+// returns how many were replaced.
+int Editor::replaceMatches(const std::vector<SearchMatch> &matches, std::string_view with)
+{
+  const auto logEdit = [this](UndoLog::Op op, int yindex, int xindex, std::string_view chars)
+  {
+    m_buf->undo.record(op, yindex, xindex, chars);
+    m_buf->journal.append(op, yindex, xindex, chars);
+  };
+
+  int replaced = 0;
+  std::string text;
+  for (std::size_t i = 0; i < matches.size();)
+  {
+    const int y = matches[i].row;
+    auto &erow = m_buf->rows[y];
+    const std::string_view row = erow.row;
+    text.clear();
+    text.reserve(row.size());
+
+    // text holds the row as the edits logged so far leave it, up to `from`
+    std::size_t from = 0;
+    for (; i < matches.size() && matches[i].row == y; ++i)
     {
-      last_match = current;
-      m_cy = current;
-      m_cx = convertRowRxToCx(m_rows[current], static_cast<int>(match_start_offset));
-      m_rowoff = m_rows.size();
+      const auto col = static_cast<std::size_t>(matches[i].col);
+      if (col < from)
+        continue;
 
-      saved_hl_line = current;
-      saved_hl.reserve(row.rendered.size());
-      std::copy(row.hl.begin(), row.hl.end(), std::back_inserter(saved_hl));
+      text.append(row.substr(from, col - from));
+      const int at = static_cast<int>(text.size());
+      const auto old = row.substr(col, matches[i].len);
+      if (!old.empty())
+        logEdit(UndoLog::Op::DELETE_CHARS, y, at, old);
+      if (!with.empty())
+        logEdit(UndoLog::Op::INSERT_CHARS, y, at, with);
+
+      text.append(with);
+      from = col + old.size();
+      replaced++;
+    }
 
-      const auto match_end_offset = row.hl.begin() + match_start_offset + query.size() > row.hl.end()
-                                        ? row.hl.end() - row.hl.begin()
-                                        : match_start_offset + query.size();
-      std::fill(row.hl.begin() + match_start_offset,
-                row.hl.begin() + match_end_offset,
-                EditorHighlight::MATCH);
-      return;
+    text.append(row.substr(from));
+    // the row's storage comes from its buffer's arena, so it is copied in
+    erow.row.assign(text);
+    updateRow(y);
+  }
+
+  if (replaced)
+    m_buf->dirty++;
+  return replaced;
+}
+
+// Asks for a query and its replacement, then steps through the matches
+// from the cursor on, wrapping around the buffer back to it: y replaces
+// one, n skips it, a replaces it and every one not seen yet at once.
+// Whatever gets replaced is undone in one step.
+void Editor::replace()
+{
+  const auto mode = m_search_regex ? SearchMode::REGEX : SearchMode::LITERAL;
+  const auto query = fromPrompt(m_search_regex ? "Replace regex: %s (ESC to cancel)" : "Replace: %s (ESC to cancel)");
+  if (query.empty())
+    return;
+
+  bool cancelled = false;
+  const auto with = fromPrompt("Replace with: %s (ESC to cancel)", [&](std::string &, int key)
+                               { cancelled = key == '\x1b'; },
+                               true);
+  if (cancelled)
+    return;
+
+  const UndoLog::Cursor origin = {m_buf->cx, m_buf->cy};
+  // matches are offered from `at` on, and once wrapped up to `stop`
+  SearchMatch at = {m_buf->cy, m_buf->cx, 0};
+  SearchMatch stop = at;
+  bool wrapped = false, open = false, failed = false;
+  int replaced = 0;
+  std::vector<SearchMatch> selected;
+  while (true)
+  {
+    const auto &matches = m_search.update(m_buf->rows, m_buf->version, query, mode);
+    if (!m_search.error().empty())
+    {
+      setStatusMessage("%s", m_search.error().c_str());
+      failed = true;
+      break;
+    }
+
+    const auto it = std::lower_bound(matches.begin(), matches.end(), at);
+    const auto end = std::lower_bound(matches.begin(), matches.end(), stop);
+    if (!wrapped && it == matches.end())
+    {
+      wrapped = true;
+      at = {0, 0, 0};
+      continue;
     }
+    if (wrapped && it >= end)
+      break;
+
+    m_search_hl = *it;
+    m_buf->cy = it->row;
+    m_buf->cx = it->col;
+    setStatusMessage("Replace this match? (y/n, a for all, ESC to stop)");
+    refreshScreen();
+    waitForInput();
+
+    const int key = m_term->readKey();
+    if (key != 'y' && key != 'a')
+    {
+      if (key != 'n')
+        break;
+      at = {it->row, it->col + 1, 0};
+      continue;
+    }
+
+    if (!open)
+    {
+      m_buf->undo.begin(UndoLog::Kind::OTHER, origin);
+      open = true;
+    }
+
+    if (key == 'a')
+    {
+      // the matches skipped so far are the ones between `stop` and here
+      selected.clear();
+      if (!wrapped)
+        selected.assign(matches.begin(), end);
+      selected.insert(selected.end(), it, wrapped ? end : matches.end());
+      replaced += replaceMatches(selected, with);
+      break;
+    }
+
+    // the rest of the row is searched after the replacement, stepping past
+    // an empty match so it is not offered again
+    const auto shift = static_cast<int>(with.size()) - it->len;
+    if (wrapped && it->row == stop.row)
+      stop.col += shift;
+    at = {it->row, it->col + static_cast<int>(with.size()) + (it->len == 0 ? 1 : 0), 0};
+    m_buf->cx = it->col + static_cast<int>(with.size());
+    selected.assign(1, *it);
+    replaced += replaceMatches(selected, with);
   }
+
+  if (open)
+    m_buf->undo.end({m_buf->cx, m_buf->cy});
+  m_search_hl.row = -1;
+  m_search.clear();
+  if (!failed)
+    setStatusMessage("Replaced %d occurrence%s", replaced, replaced == 1 ? "" : "s");
 }
 
-void Editor::find()
+/*** output ***/
+
+namespace
+{
+  // Appends the decimal digits of n without going through a temporary string.
+  template <typename T>
+  void appendNumber(std::string &s, T n)
+  {
+    char digits[24];
+    const auto end = std::to_chars(digits, digits + sizeof(digits), n).ptr;
+    s.append(digits, end - digits);
+  }
+}
+
+void Editor::scroll()
 {
-  int saved_cx = m_cx;
-  int saved_cy = m_cy;
-  int saved_coloff = m_coloff;
-  int saved_rowoff = m_rowoff;
+  m_rx = m_buf->cx;
+  if (m_buf->cy < static_cast<int>(m_buf->rows.size()))
+  {
+    // the viewer leaves the row under the cursor in the mapping
+    if (m_view)
+      m_rx = utf8CxToRx(m_buf->rows.lineAt(m_buf->cy), m_buf->cx);
+    else
+      convertRowCxToRx(m_buf->rows[m_buf->cy]);
+  }
+
+  const int wrap_cols = m_wrap ? m_screencols : 0;
+  if (m_buf->rows.wrapColumns() != wrap_cols)
+    m_buf->rows.setWrap(wrap_cols, renderedWidth);
+
+  if (m_wrap)
+  {
+    const auto cursor = m_buf->rows.visualLineOf(m_buf->cy) + m_rx / m_screencols;
+    const auto screenrows = static_cast<std::size_t>(m_screenrows);
+    auto top = screenTop();
+    if (cursor < top)
+      top = cursor;
+    if (cursor >= top + screenrows)
+      top = cursor - screenrows + 1;
+
+    std::size_t offset;
+    m_buf->rowoff = static_cast<int>(m_buf->rows.rowAtVisualLine(top, offset));
+    m_buf->wrapoff = static_cast<int>(offset);
+    m_buf->coloff = 0;
+
+    m_screen_y = static_cast<int>(cursor - top);
+    m_screen_x = m_rx % m_screencols;
+    return;
+  }
+
+  m_buf->wrapoff = 0;
+  if (m_buf->cy < m_buf->rowoff)
+    m_buf->rowoff = m_buf->cy;
+
+  if (m_buf->cy >= m_buf->rowoff + m_screenrows)
+    m_buf->rowoff = m_buf->cy - m_screenrows + 1;
+
+  if (m_rx < m_buf->coloff)
+    m_buf->coloff = m_rx;
+
+  if (m_rx >= m_buf->coloff + m_screencols)
+    m_buf->coloff = m_rx - m_screencols + 1;
+
+  m_screen_y = m_buf->cy - m_buf->rowoff;
+  m_screen_x = m_rx - m_buf->coloff;
+}
+
+// Screen line of the whole buffer shown at the top of the text area.
+std::size_t Editor::screenTop() const
+{
+  if (!m_wrap)
+    return m_buf->rowoff;
+  return m_buf->rows.visualLineOf(m_buf->rowoff) + m_buf->wrapoff;
+}
+
+void Editor::drawRows(std::vector<std::string> &frame)
+{
+  Profiler::Timer timer(m_profiler, Profiler::DRAW_ROWS);
+
+  // a wrapped row goes on for as many screen lines as it takes
+  int filerow = m_buf->rowoff;
+  int wrapoff = m_buf->wrapoff;
+  for (int y = 0; y < m_screenrows; ++y)
+  {
+    auto &s = frame[y];
+    s.clear();
+
+    if (filerow >= static_cast<int>(m_buf->rows.size()))
+    {
+      if (m_buf->rows.empty() && y == m_screenrows / 3)
+      {
+        constexpr std::string_view banner = "Kilo++ editor -- version " KILO_VERSION;
+        const auto welcome = banner.substr(0, m_screencols);
+
+        auto padding = (static_cast<std::size_t>(m_screencols) - welcome.size()) / 2;
+        if (padding)
+        {
+          s += "~";
+          padding--;
+        }
+
+        s.append(padding, ' ');
+        s += welcome;
+      }
+      else
+      {
+        s += "~";
+      }
+    }
+    else
+    {
+      drawRow(s, filerow, m_wrap ? wrapoff * m_screencols : m_buf->coloff);
+      if (!m_wrap || ++wrapoff == static_cast<int>(m_buf->rows.visualLinesAt(filerow)))
+      {
+        filerow++;
+        wrapoff = 0;
+      }
+    }
+  }
+}
 
-  std::string query = fromPrompt("Search: %s (Use ESC/Arrows/Enter)", [this](std::string &query, int key)
-                                 { findCallback(query, key); });
+// Builds the rows on screen from the mapping for the viewer, highlighted from
+// the top of the screen down; a comment opened above the screen is not seen.
+void Editor::prepareViewRows()
+{
+  const auto first = static_cast<std::size_t>(m_buf->rowoff);
+  const auto last = std::min(first + m_screenrows, m_buf->rows.size());
+  if (m_view_rows.size() < static_cast<std::size_t>(m_screenrows))
+    m_view_rows.resize(m_screenrows);
+
+  // a comment opened above the screen is found from the comment-state
+  // index, which reads past lines without keeping them
+  bool in_comment = false;
+  if (m_buf->syntax && first > 0)
+  {
+    indexCommentStates(static_cast<int>(first));
+    in_comment = m_buf->hl_comment_index[first - 1];
+  }
 
-  if (query.empty())
+  for (auto y = first; y < last; ++y)
   {
-    m_cx = saved_cx;
-    m_cy = saved_cy;
-    m_coloff = saved_coloff;
-    m_rowoff = saved_rowoff;
+    auto &erow = m_view_rows[y - first];
+    erow.row.assign(m_buf->rows.lineAt(y));
+    indexTabs(erow);
+    updateSyntax(erow, in_comment);
+    in_comment = erow.hl_open_comment;
   }
 }
 
-/*** output ***/
-
-void Editor::scroll()
+// Draws the part of a row from rendered column `coloff` on.
+void Editor::drawRow(std::string &s, int filerow, int coloff)
 {
-  m_rx = m_cx;
-  if (m_cy < static_cast<int>(m_rows.size()))
-    convertRowCxToRx(m_rows[m_cy]);
-
-  if (m_cy < m_rowoff)
-    m_rowoff = m_cy;
-
-  if (m_cy >= m_rowoff + m_screenrows)
-    m_rowoff = m_cy - m_screenrows + 1;
+  auto &erow = m_view ? m_view_rows[filerow - m_buf->rowoff] : m_buf->rows[filerow];
+  const bool hl_ready = m_view || !m_buf->syntax || filerow < m_buf->hl_stale_from ||
+                        (m_buf->hl_window_version == m_buf->version &&
+                         filerow >= m_buf->hl_window_first && filerow <= m_buf->hl_window_last);
+
+  // walk the raw row from the character under the left edge, expanding
+  // tabs as they come; spans and the match are in raw columns too
+  const int row_end = static_cast<int>(erow.row.size());
+  const int screen_end = coloff + m_screencols;
+  int cx = rowRxToCx(erow, coloff);
+  int rx = rowCxToRx(erow, cx);
+
+  // the current match is laid over the row's own spans
+  int match_start = -1, match_end = -1;
+  if (filerow == m_search_hl.row)
+  {
+    match_start = m_search_hl.col;
+    match_end = m_search_hl.col + m_search_hl.len;
+  }
 
-  if (m_rx < m_coloff)
-    m_coloff = m_rx;
+  auto span = std::partition_point(erow.hl.begin(), erow.hl.end(), [cx](const HighlightSpan &sp)
+                                   { return static_cast<int>(sp.start + sp.len) <= cx; });
 
-  if (m_rx >= m_coloff + m_screencols)
-    m_coloff = m_rx - m_screencols + 1;
-}
+  int current_color = -1;
+  auto current_hl = EditorHighlight::NORMAL;
 
-void Editor::drawRows(std::string &s)
-{
-  for (int y = 0; y < m_screenrows; ++y)
+  // controls and bytes that are not UTF-8 show as a symbol in reverse video
+  const auto draw_placeholder = [&](char c)
+  {
+    s += "\x1b[7m";
+    s += c >= 0 && c <= 26 ? '@' + c : '?';
+    s += "\x1b[m";
+    if (current_color != -1)
+      s += m_sgr[static_cast<std::size_t>(current_hl)];
+  };
+
+  while (cx < row_end && rx < screen_end)
   {
-    auto filerow = y + m_rowoff;
-    if (filerow >= static_cast<int>(m_rows.size()))
+    // find the class at cx and how far it reaches
+    auto hl = EditorHighlight::NORMAL;
+    int run_end = row_end;
+    if (hl_ready && span != erow.hl.end())
     {
-      if (m_rows.empty() && y == m_screenrows / 3)
+      if (static_cast<int>(span->start) <= cx)
       {
-        std::string welcome = "Kilo++ editor -- version " + std::string(KILO_VERSION);
-        if (welcome.size() > static_cast<std::size_t>(m_screencols))
-          welcome.resize(m_screencols);
-
-        auto padding = (static_cast<std::size_t>(m_screencols) - welcome.size()) / 2;
-        if (padding)
-        {
-          s += "~";
-          padding--;
-        }
-
-        while (padding--)
-          s += " ";
-
-        s += welcome;
+        hl = span->hl;
+        run_end = std::min(run_end, static_cast<int>(span->start + span->len));
       }
       else
       {
-        s += "~";
+        run_end = std::min(run_end, static_cast<int>(span->start));
       }
     }
-    else
+    if (cx >= match_start && cx < match_end)
+    {
+      hl = EditorHighlight::MATCH;
+      run_end = std::min(run_end, match_end);
+    }
+    else if (match_start > cx)
+    {
+      run_end = std::min(run_end, match_start);
+    }
+
+    const int color = hl == EditorHighlight::NORMAL ? -1 : convertSyntaxToColor(hl);
+    if (current_color != color)
+    {
+      current_color = color;
+      current_hl = hl;
+      s += m_sgr[static_cast<std::size_t>(hl)];
+    }
+
+    for (; cx < run_end && rx < screen_end; ++cx)
     {
-      int len = static_cast<int>(m_rows[filerow].rendered.size()) - m_coloff;
-      if (len < 0)
-        len = 0;
+      const auto &c = erow.row[cx];
+      if (c == '\t')
+      {
+        // a tab cut by the left edge only shows its visible part
+        const int next_rx = rx + KILO_TAB_STOP - (rx % KILO_TAB_STOP);
+        s.append(std::min(next_rx, screen_end) - std::max(rx, coloff), ' ');
+        rx = next_rx;
+        continue;
+      }
 
-      int current_color = -1;
-      for (int i = 0; i < len; ++i)
+      if (erow.ascii)
       {
-        const auto &c = m_rows[filerow].rendered[m_coloff + i];
-        const auto &hl = m_rows[filerow].hl[m_coloff + i];
         if (std::iscntrl(c))
-        {
-          char sym = c <= 26 ? '@' + c : '?';
-          s += "\x1b[7m";
-          s += std::string(1, sym);
-          s += "\x1b[m";
-          if (current_color != -1)
-            s += "\x1b[" + std::to_string(current_color) + "m";
-        }
-        else if (hl == EditorHighlight::NORMAL)
-        {
-          if (current_color != -1)
-          {
-            s += "\x1b[39m";
-            current_color = -1;
-          }
-          s += std::string(1, c);
-        }
+          draw_placeholder(c);
         else
-        {
-          const auto color = convertSyntaxToColor(hl);
-          if (current_color != color)
-          {
-            current_color = color;
-            std::vector<char> buf(16);
-            snprintf(buf.data(), buf.size(), "\x1b[%dm", color);
-            s += buf.data();
-          }
-          s += std::string(1, c);
-        }
+          s += c;
+        rx++;
+        continue;
       }
-      s += "\x1b[39m";
+
+      // a character cut by either edge of the screen shows as blanks
+      const auto cluster = utf8::cluster(erow.row, cx);
+      if (rx < coloff || rx + cluster.width > screen_end)
+        s.append(std::min(rx + cluster.width, screen_end) - std::max(rx, coloff), ' ');
+      else if (!cluster.printable)
+        draw_placeholder(c);
+      else
+        s.append(erow.row, cx, cluster.end - cx);
+      rx += cluster.width;
+      cx = static_cast<int>(cluster.end) - 1;
     }
 
-    s += "\x1b[K\r\n";
+    if (span != erow.hl.end() && static_cast<int>(span->start + span->len) <= cx)
+      ++span;
   }
+  s += "\x1b[39m";
 }
 
 void Editor::drawStatusBar(std::string &s)
 {
+  s.clear();
   s += "\x1b[7m";
 
-  std::stringstream ss, rss;
-  ss << (m_filename.empty()
-             ? "[No Name]"
-             : m_filename.substr(0, std::min(static_cast<int>(m_filename.size()), FILENAME_DISPLAY_LEN)))
-     << " - "
-     << m_rows.size()
-     << " lines"
-     << (m_dirty ? "(modified)" : "");
-  int len = std::min(static_cast<int>(ss.str().size()), m_screencols);
-
-  rss << (m_syntax ? m_syntax->filetype : "no ft")
-      << " | "
-      << m_cy + 1
-      << "/"
-      << m_rows.size();
-  int rlen = rss.str().size();
-
-  s += ss.str().substr(0, len);
-  while (len < m_screencols)
-  {
-    if (m_screencols - len == rlen)
-    {
-      s += rss.str();
-      break;
-    }
-    s += " ";
-    len++;
+  const auto left = s.size();
+  if (m_buffers.size() > 1)
+  {
+    s += "[";
+    appendNumber(s, m_current + 1);
+    s += "/";
+    appendNumber(s, m_buffers.size());
+    s += "] ";
+  }
+  s.append(m_buf->filename.empty() ? "[No Name]" : std::string_view(m_buf->filename).substr(0, FILENAME_DISPLAY_LEN));
+  s += " - ";
+  appendNumber(s, m_buf->rows.size());
+  s += " lines";
+  if (m_buf->dirty)
+    s += "(modified)";
+  if (m_view)
+    s += m_follow ? " [following]" : " [read-only]";
+  if (s.size() - left > static_cast<std::size_t>(m_screencols))
+    s.resize(left + m_screencols);
+  const int len = static_cast<int>(s.size() - left);
+
+  auto &rs = m_status_right;
+  rs.clear();
+  if (m_frame_allocations)
+  {
+    appendNumber(rs, m_frame_allocations);
+    rs += " allocs | ";
+  }
+  rs += m_search_status;
+  rs += m_buf->syntax ? m_buf->syntax->filetype : "no ft";
+  rs += " | ";
+  appendNumber(rs, m_buf->cy + 1);
+  rs += "/";
+  appendNumber(rs, m_buf->rows.size());
+  const int rlen = static_cast<int>(rs.size());
+
+  if (m_screencols - len >= rlen)
+  {
+    s.append(m_screencols - len - rlen, ' ');
+    s += rs;
+  }
+  else
+  {
+    s.append(m_screencols - len, ' ');
   }
 
-  s += "\x1b[m\r\n";
+  s += "\x1b[m";
 }
 
 void Editor::drawMessageBar(std::string &s)
 {
-  s += "\x1b[K";
+  s.clear();
   int msglen = static_cast<int>(m_statusmsg.size());
   if (msglen > m_screencols)
     msglen = m_screencols;
 
-  if (msglen && time(NULL) - m_statusmsg_time < 5)
-    s += m_statusmsg.substr(0, msglen);
+  if (msglen && time(NULL) - m_statusmsg_time < KILO_STATUS_TIMEOUT)
+    s.append(m_statusmsg, 0, msglen);
+  else if (m_profiler.enabled())
+    m_profiler.appendSummary(s, m_screencols);
+}
+
+void Editor::scrollShadow(std::string &s)
+{
+  const auto top = screenTop();
+  const auto delta = static_cast<long long>(top) - static_cast<long long>(m_shadow_top);
+  m_shadow_top = top;
+
+  if (!m_shadow_valid || delta == 0 || std::abs(delta) >= m_screenrows)
+    return;
+
+  // let the terminal move the text area itself and only repaint the lines
+  // that scrolled into view
+  s += "\x1b[1;";
+  appendNumber(s, m_screenrows);
+  s += "r";
+  const auto first = m_shadow.begin();
+  const auto last = m_shadow.begin() + m_screenrows;
+  if (delta > 0)
+  {
+    s += "\x1b[";
+    appendNumber(s, delta);
+    s += "S";
+    std::rotate(first, first + delta, last);
+    std::for_each(last - delta, last, [](auto &line)
+                  { line.clear(); });
+  }
+  else
+  {
+    s += "\x1b[";
+    appendNumber(s, -delta);
+    s += "T";
+    std::rotate(first, last + delta, last);
+    std::for_each(first, first - delta, [](auto &line)
+                  { line.clear(); });
+  }
+  s += "\x1b[r";
+}
+
+void Editor::drawChangedLines(std::string &s)
+{
+  for (int y = 0; y < static_cast<int>(m_frame.size()); ++y)
+  {
+    if (m_shadow_valid && m_frame[y] == m_shadow[y])
+      continue;
+
+    s += "\x1b[";
+    appendNumber(s, y + 1);
+    s += ";1H";
+    s += m_frame[y];
+    s += "\x1b[K";
+  }
+
+  // the frame just drawn becomes the shadow; the old shadow's storage is
+  // reused for composing the next frame
+  std::swap(m_frame, m_shadow);
+  m_shadow_valid = true;
 }
 
 void Editor::refreshScreen()
 {
   scroll();
+  if (m_batch)
+    return;
+
+  enforceMemoryBudget();
+  if (m_view)
+    prepareViewRows();
+  else
+    ensureSyntax(m_buf->rowoff + m_screenrows - 1);
+
+  // text area plus status and message bars; every line gets room for the
+  // worst case of an escape sequence around each column, so drawing never
+  // has to grow them
+  const auto lines = static_cast<std::size_t>(m_screenrows) + 2;
+  const auto line_capacity = static_cast<std::size_t>(m_screencols) * 20 + 32;
+  const bool resized = m_frame.size() != lines || m_shadow.size() != lines ||
+                       m_frame[0].capacity() < line_capacity;
+  if (resized)
+  {
+    m_frame.assign(lines, std::string());
+    m_shadow.assign(lines, std::string());
+    for (std::size_t y = 0; y < lines; ++y)
+    {
+      m_frame[y].reserve(line_capacity);
+      m_shadow[y].reserve(line_capacity);
+    }
+    m_out.reserve(lines * (line_capacity + 16) + 64);
+    m_status_right.reserve(line_capacity);
+    m_shadow_valid = false;
+  }
+
+  const auto allocations = allocation_counter::count();
+
+  drawRows(m_frame);
+  drawStatusBar(m_frame[m_screenrows]);
+  drawMessageBar(m_frame[m_screenrows + 1]);
 
-  std::string s;
+  auto &s = m_out;
+  s.clear();
 
   s += "\x1b[?25l";
-  s += "\x1b[H";
 
-  drawRows(s);
-  drawStatusBar(s);
-  drawMessageBar(s);
+  scrollShadow(s);
+  drawChangedLines(s);
 
-  std::stringstream ss;
-  ss << "\x1b[" << (m_cy - m_rowoff) + 1 << ";" << (m_rx - m_coloff) + 1 << "H" << "\x1b[?25h";
-  s += ss.str();
+  s += "\x1b[";
+  appendNumber(s, m_screen_y + 1);
+  s += ";";
+  appendNumber(s, m_screen_x + 1);
+  s += "H\x1b[?25h";
 
-  write(STDOUT_FILENO, s.c_str(), s.size());
+  {
+    Profiler::Timer timer(m_profiler, Profiler::WRITE);
+    m_term->write(s);
+  }
+  m_redraw = false;
+  m_last_frame = std::chrono::steady_clock::now();
+
+  // a frame right after a resize sets up its buffers and does not count
+  m_frame_allocations = resized ? 0 : allocation_counter::count() - allocations;
 }
 
 void Editor::setStatusMessage(const char *fmt, ...)
@@ -814,15 +1754,16 @@ void Editor::setStatusMessage(const char *fmt, ...)
 /*** input ***/
 
 std::string Editor::fromPrompt(
-    std::string prompt, std::function<void(std::string &, int)> callback)
+    std::string prompt, std::function<void(std::string &, int)> callback, bool allow_empty)
 {
   std::string s = "\0";
   while (1)
   {
     setStatusMessage(prompt.c_str(), s.c_str());
     refreshScreen();
+    waitForInput();
 
-    int c = terminal_manager::readKey();
+    int c = m_term->readKey();
     if (c == static_cast<int>(EditorKey::DEL_KEY) ||
         c == CTRL_KEY('h') ||
         c == static_cast<int>(EditorKey::BACKSPACE))
@@ -839,7 +1780,7 @@ std::string Editor::fromPrompt(
     }
     else if (c == '\r')
     {
-      if (s.size())
+      if (s.size() || allow_empty)
       {
         setStatusMessage("");
         if (callback)
@@ -847,8 +1788,18 @@ std::string Editor::fromPrompt(
         return s;
       }
     }
-    else if (!iscntrl(c) && c < 128)
+    else if (c == static_cast<int>(EditorKey::PASTE))
     {
+      // the prompt is a single line; keep what is printable
+      for (const char ch : m_term->pastedText())
+      {
+        if (!iscntrl(static_cast<unsigned char>(ch)))
+          s += ch;
+      }
+    }
+    else if (c < 0 || (!iscntrl(c) && c < 128))
+    {
+      // a UTF-8 character arrives a byte at a time, each one negative
       s += c;
     }
 
@@ -857,50 +1808,285 @@ std::string Editor::fromPrompt(
   }
 }
 
+// Waits up to timeout_ms (forever if negative) for something to happen and
+// deals with whatever did: a resize, highlighting results or an expired
+// status message only mark the screen for redrawing. Returns whether a key
+// is ready to be read.
+bool Editor::pollEvents(int timeout_ms)
+{
+  // a terminal without an input descriptor has all its keys queued, and
+  // running out of them is for readKey() to report
+  if (m_term->inputPending() || m_term->inputFd() == -1)
+    return true;
+
+  pollfd fds[4] = {{m_term->inputFd(), POLLIN, 0},
+                   {m_syntax_worker.notifyFd(), POLLIN, 0},
+                   {m_term->resizeFd(), POLLIN, 0},
+                   {m_watcher.fd(), POLLIN, 0}};
+
+  const int timer = nextTimeout();
+  if (timer >= 0 && (timeout_ms < 0 || timer < timeout_ms))
+    timeout_ms = timer;
+
+  // a signal interrupting the wait is picked up from the pipe next time
+  if (poll(fds, 4, timeout_ms) == -1)
+  {
+    if (errno == EINTR)
+      return false;
+    terminal_manager::die("poll");
+  }
+
+  if ((fds[2].revents & POLLIN) && m_term->takeResize())
+    handleResize();
+
+  if ((fds[1].revents & POLLIN) && applySyntaxResults())
+    m_redraw = true;
+
+  if ((fds[3].revents & POLLIN) && m_watcher.takeChanges())
+    followFile();
+
+  if (!m_statusmsg.empty() && time(NULL) - m_statusmsg_time >= KILO_STATUS_TIMEOUT)
+  {
+    m_statusmsg.clear();
+    m_redraw = true;
+  }
+
+  return fds[0].revents & (POLLIN | POLLHUP);
+}
+
+// Milliseconds until the status message expires, or -1 if none is shown.
+int Editor::nextTimeout() const
+{
+  if (m_statusmsg.empty())
+    return -1;
+
+  const auto left = m_statusmsg_time + KILO_STATUS_TIMEOUT - time(NULL);
+  return left > 0 ? static_cast<int>(left) * 1000 : 0;
+}
+
+void Editor::handleResize()
+{
+  int rows, cols;
+  if (!m_term->getWindowSize(rows, cols) || rows < 3 || cols < 1)
+    return;
+
+  m_screenrows = rows - 2;
+  m_screencols = cols;
+
+  // the terminal has rearranged what it showed, so nothing on it is known
+  m_shadow_valid = false;
+  m_redraw = true;
+}
+
+// Blocks until a key is available, redrawing whenever something else
+// changes the screen in the meantime.
+void Editor::waitForInput()
+{
+  while (!pollEvents(-1))
+  {
+    if (m_redraw)
+      refreshScreen();
+  }
+}
+
 void Editor::moveCursor(int key)
 {
   switch (key)
   {
   case static_cast<int>(EditorKey::ARROW_UP):
-    if (m_cy > 0)
-      m_cy--;
+    if (m_buf->cy > 0)
+      m_buf->cy--;
     break;
   case static_cast<int>(EditorKey::ARROW_DOWN):
-    if (m_cy < static_cast<int>(m_rows.size()) - 1)
-      m_cy++;
+    if (m_buf->cy < static_cast<int>(m_buf->rows.size()) - 1)
+      m_buf->cy++;
     break;
   case static_cast<int>(EditorKey::ARROW_LEFT):
-    if (m_cx > 0)
+    if (m_buf->cx > 0)
     {
-      m_cx--;
+      const auto &erow = m_buf->rows[m_buf->cy];
+      m_buf->cx = erow.ascii ? m_buf->cx - 1 : static_cast<int>(utf8::clusterStart(erow.row, m_buf->cx - 1));
     }
-    else if (m_cy > 0)
+    else if (m_buf->cy > 0)
     {
-      m_cy--;
-      m_cx = static_cast<int>(m_rows[m_cy].row.size());
+      m_buf->cy--;
+      m_buf->cx = static_cast<int>(m_buf->rows[m_buf->cy].row.size());
     }
     break;
   case static_cast<int>(EditorKey::ARROW_RIGHT):
-    if (m_cx < static_cast<int>(m_rows[m_cy].row.size()))
+    if (m_buf->cy >= static_cast<int>(m_buf->rows.size()))
+      break;
+
+    if (m_buf->cx < static_cast<int>(m_buf->rows[m_buf->cy].row.size()))
     {
-      m_cx++;
+      const auto &erow = m_buf->rows[m_buf->cy];
+      m_buf->cx = erow.ascii ? m_buf->cx + 1 : static_cast<int>(utf8::cluster(erow.row, m_buf->cx).end);
     }
-    else if (m_cy < static_cast<int>(m_rows.size()) - 1)
+    else if (m_buf->cy < static_cast<int>(m_buf->rows.size()) - 1)
     {
-      m_cy++;
-      m_cx = 0;
+      m_buf->cy++;
+      m_buf->cx = 0;
     }
     break;
   }
 
-  if (m_cx > static_cast<int>(m_rows[m_cy].row.size()))
-    m_cx = static_cast<int>(m_rows[m_cy].row.size());
+  // the cursor may sit on the line past the end of the buffer, which has no row
+  if (m_buf->cy >= static_cast<int>(m_buf->rows.size()))
+  {
+    m_buf->cx = 0;
+    return;
+  }
+
+  // moving up or down never leaves it inside a character
+  const auto &erow = m_buf->rows[m_buf->cy];
+  const int rowlen = static_cast<int>(erow.row.size());
+  if (m_buf->cx > rowlen)
+    m_buf->cx = rowlen;
+  else if (!erow.ascii && m_buf->cx < rowlen)
+    m_buf->cx = static_cast<int>(utf8::clusterStart(erow.row, m_buf->cx));
+}
+
+// Moves a screen of wrapped lines up or down, straight to the row shown on
+// the screen line it lands on.
+void Editor::pageWrapped(bool down)
+{
+  const auto screenrows = static_cast<std::size_t>(m_screenrows);
+  const auto top = screenTop();
+  const auto target = down ? top + 2 * screenrows - 1 : top - std::min(top, screenrows);
+
+  std::size_t offset;
+  auto row = m_buf->rows.rowAtVisualLine(target, offset);
+  if (row >= m_buf->rows.size())
+  {
+    if (m_buf->rows.empty())
+      return;
+    row = m_buf->rows.size() - 1;
+    offset = m_buf->rows.visualLinesAt(row) - 1;
+  }
+
+  m_buf->cy = static_cast<int>(row);
+  m_buf->cx = utf8RxToCx(m_buf->rows.lineAt(row), static_cast<int>(offset) * m_screencols);
+}
+
+// Keys of the viewer that move around without going through the rows
+// themselves, and the refusal of those that would edit. Returns false for
+// keys that act as in the editor.
+bool Editor::processViewKeypress(int c)
+{
+  switch (c)
+  {
+  case CTRL_KEY('q'):
+  case CTRL_KEY('f'):
+  case CTRL_KEY('e'):
+  case CTRL_KEY('t'):
+  case CTRL_KEY('g'):
+  case CTRL_KEY('l'):
+  case '\x1b':
+    return false;
+  case 'q':
+    m_quit = true;
+    return true;
+  case '/':
+    find();
+    return true;
+  }
+
+  if (m_buf->rows.empty())
+    return true;
+
+  const int last = static_cast<int>(m_buf->rows.size()) - 1;
+  switch (c)
+  {
+  case 'g':
+    m_buf->cy = 0;
+    m_buf->cx = 0;
+    break;
+  case 'G':
+    m_buf->cy = last;
+    m_buf->cx = 0;
+    break;
+  case ' ':
+  case static_cast<int>(EditorKey::PAGE_UP):
+  case static_cast<int>(EditorKey::PAGE_DOWN):
+  {
+    const bool down = c != static_cast<int>(EditorKey::PAGE_UP);
+    if (m_wrap)
+      pageWrapped(down);
+    else if (down)
+      m_buf->cy = std::min(m_buf->rowoff + 2 * m_screenrows - 1, last);
+    else
+      m_buf->cy = std::max(m_buf->rowoff - m_screenrows, 0);
+  }
+  break;
+  case static_cast<int>(EditorKey::ARROW_UP):
+    m_buf->cy = std::max(m_buf->cy - 1, 0);
+    break;
+  case static_cast<int>(EditorKey::ARROW_DOWN):
+    m_buf->cy = std::min(m_buf->cy + 1, last);
+    break;
+  case static_cast<int>(EditorKey::ARROW_LEFT):
+    if (m_buf->cx > 0)
+      m_buf->cx = static_cast<int>(utf8::clusterStart(m_buf->rows.lineAt(m_buf->cy), m_buf->cx - 1));
+    break;
+  case static_cast<int>(EditorKey::ARROW_RIGHT):
+  {
+    const auto line = m_buf->rows.lineAt(m_buf->cy);
+    if (m_buf->cx < static_cast<int>(line.size()))
+      m_buf->cx = static_cast<int>(utf8::cluster(line, m_buf->cx).end);
+  }
+  break;
+  case static_cast<int>(EditorKey::HOME_KEY):
+    m_buf->cx = 0;
+    break;
+  case static_cast<int>(EditorKey::END_KEY):
+    m_buf->cx = static_cast<int>(m_buf->rows.lineAt(m_buf->cy).size());
+    break;
+  default:
+    setStatusMessage("Read-only: q quit | / find | g/G top/bottom | ^E wrap");
+    return true;
+  }
+
+  const auto line = m_buf->rows.lineAt(m_buf->cy);
+  if (m_buf->cx >= static_cast<int>(line.size()))
+    m_buf->cx = static_cast<int>(line.size());
+  else
+    m_buf->cx = static_cast<int>(utf8::clusterStart(line, m_buf->cx));
+  return true;
+}
+
+// Takes in what was appended to the followed file. A cursor on the last line
+// stays on the last line, so the newest lines keep coming into view.
+void Editor::followFile()
+{
+  const auto lines = m_follow_source->lineCount();
+  const bool at_end = m_buf->cy + 1 >= static_cast<int>(m_buf->rows.size());
+  if (!m_follow_source->grow())
+  {
+    m_watcher.stop();
+    m_follow = false;
+    setStatusMessage("File was truncated or cannot be read; stopped following");
+    m_redraw = true;
+    return;
+  }
+
+  m_buf->rows.appendSourceLines(lines);
+  // the old last line may have grown
+  invalidateSyntax(static_cast<int>(lines ? lines - 1 : 0));
+  if (at_end && !m_buf->rows.empty())
+  {
+    m_buf->cy = static_cast<int>(m_buf->rows.size()) - 1;
+    m_buf->cx = 0;
+  }
+  m_redraw = true;
 }
 
 void Editor::processKeypress()
 {
-  static int quit_times = KILO_QUIT_TIMES;
-  int c = terminal_manager::readKey();
+  int c = m_term->readKey();
+  Profiler::Timer timer(m_profiler, Profiler::KEYPRESS);
+
+  if (m_view && processViewKeypress(c))
+    return;
 
   switch (c)
   {
@@ -908,31 +2094,64 @@ void Editor::processKeypress()
     insertNewline();
     break;
   case CTRL_KEY('q'):
-    if (m_dirty && quit_times > 0)
+    if (anyBufferDirty() && m_quit_times > 0)
     {
       setStatusMessage(
           "WARNING!!! File has unsaved changes. Press Ctrl-Q %d more times to quit.",
-          quit_times);
-      quit_times--;
+          m_quit_times);
+      m_quit_times--;
       return;
     }
-    write(STDOUT_FILENO, "\x1b[2J", 4);
-    write(STDOUT_FILENO, "\x1b[H", 3);
-    exit(0);
+    for (auto &buffer : m_buffers)
+      buffer->journal.discard();
+    m_quit = true;
     break;
   case CTRL_KEY('s'):
     save();
     break;
   case static_cast<int>(EditorKey::HOME_KEY):
-    m_cx = 0;
+    m_buf->cx = 0;
     break;
   case static_cast<int>(EditorKey::END_KEY):
-    if (m_cy < static_cast<int>(m_rows.size()))
-      m_cx = m_rows[m_cy].row.size();
+    if (m_buf->cy < static_cast<int>(m_buf->rows.size()))
+      m_buf->cx = m_buf->rows[m_buf->cy].row.size();
     break;
   case CTRL_KEY('f'):
     find();
     break;
+  case CTRL_KEY('r'):
+    replace();
+    break;
+  case CTRL_KEY('z'):
+    undo();
+    break;
+  case CTRL_KEY('y'):
+    redo();
+    break;
+  case CTRL_KEY('o'):
+  {
+    const auto filename = fromPrompt("Open: %s (ESC to cancel)");
+    if (!filename.empty())
+      openBuffer(filename);
+  }
+  break;
+  case CTRL_KEY('n'):
+    switchBuffer((m_current + 1) % m_buffers.size());
+    break;
+  case CTRL_KEY('p'):
+    switchBuffer((m_current + m_buffers.size() - 1) % m_buffers.size());
+    break;
+  case CTRL_KEY('w'):
+    if (m_buf->dirty && m_close_times > 0)
+    {
+      setStatusMessage(
+          "WARNING!!! Buffer has unsaved changes. Press Ctrl-W %d more times to close it.",
+          m_close_times);
+      m_close_times--;
+      return;
+    }
+    closeBuffer();
+    break;
   case static_cast<int>(EditorKey::BACKSPACE):
   case CTRL_KEY('h'):
   case static_cast<int>(EditorKey::DEL_KEY):
@@ -943,15 +2162,21 @@ void Editor::processKeypress()
   case static_cast<int>(EditorKey::PAGE_UP):
   case static_cast<int>(EditorKey::PAGE_DOWN):
   {
+    if (m_wrap)
+    {
+      pageWrapped(c == static_cast<int>(EditorKey::PAGE_DOWN));
+      break;
+    }
+
     if (c == static_cast<int>(EditorKey::PAGE_UP))
     {
-      m_cy = m_rowoff;
+      m_buf->cy = m_buf->rowoff;
     }
     else
     {
-      m_cy = m_rowoff + m_screenrows - 1;
-      if (m_cy > static_cast<int>(m_rows.size()))
-        m_cy = m_rows.size();
+      m_buf->cy = m_buf->rowoff + m_screenrows - 1;
+      if (m_buf->cy > static_cast<int>(m_buf->rows.size()))
+        m_buf->cy = m_buf->rows.size();
     }
 
     int times = m_screenrows;
@@ -970,6 +2195,20 @@ void Editor::processKeypress()
   case static_cast<int>(EditorKey::ARROW_RIGHT):
     moveCursor(c);
     break;
+  case static_cast<int>(EditorKey::PASTE):
+    insertText(m_term->pastedText());
+    break;
+  case CTRL_KEY('e'):
+    m_wrap = !m_wrap;
+    setStatusMessage(m_wrap ? "Wrap on" : "Wrap off");
+    break;
+  case CTRL_KEY('t'):
+    m_profiler.setEnabled(!m_profiler.enabled());
+    setStatusMessage(m_profiler.enabled() ? "Profiler on" : "Profiler off");
+    break;
+  case CTRL_KEY('g'):
+    showMemoryUsage();
+    break;
   case CTRL_KEY('l'):
   case '\x1b':
     break;
@@ -978,19 +2217,131 @@ void Editor::processKeypress()
     break;
   }
 
-  quit_times = KILO_QUIT_TIMES;
+  m_quit_times = KILO_QUIT_TIMES;
+  m_close_times = KILO_QUIT_TIMES;
 }
 
 void Editor::run(int argc, char *argv[])
 {
-  if (argc >= 2)
-    open(argv[1]);
+  setStatusMessage("HELP: ^S save | ^Q quit | ^F/^R find/replace | ^Z/^Y undo/redo | ^O open | ^N/^P/^W buffers");
+  startSession();
 
-  setStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+  for (int i = 1; i < argc; ++i)
+    openBuffer(argv[i]);
 
-  while (1)
+  if (m_buffers.size() > 1)
+    switchBuffer(0);
+
+  loop();
+}
+
+void Editor::view(const std::string &filename, bool follow)
+{
+  setStatusMessage("HELP: q quit | / find | g/G top/bottom | ^E wrap");
+  startSession();
+
+  m_view = true;
+  m_follow = follow;
+  openBuffer(filename);
+
+  if (m_follow && !m_watcher.watch(filename))
+    terminal_manager::die("inotify");
+
+  // following starts at the newest lines, as tail -f does
+  if (m_follow && !m_buf->rows.empty())
+    m_buf->cy = static_cast<int>(m_buf->rows.size()) - 1;
+
+  loop();
+}
+
+// Loads what every session needs before its files are opened, scripted
+// ones included.
+void Editor::startSession()
+{
+  // profiling from the start, with the results written out on quitting
+  const char *profile_path = std::getenv("KILO_PROFILE");
+  if (profile_path && *profile_path)
+    m_profiler.setEnabled(true);
+
+  // in MiB
+  const char *budget = std::getenv("KILO_MEMORY_BUDGET");
+  if (budget && *budget)
+    m_memory_budget = static_cast<std::size_t>(std::strtoull(budget, nullptr, 10)) << 20;
+
+  // the registry is shared by the whole process, and batch editors start
+  // side by side, so the first session loads it for all of them
+  static std::once_flag syntax_loaded;
+  static std::vector<std::string> syntax_errors;
+  std::call_once(syntax_loaded, []
+                 { syntax_errors = loadSyntaxFiles(syntaxDirectories(), syntaxCachePath()); });
+  if (!syntax_errors.empty())
+    setStatusMessage("Syntax file %s", syntax_errors.front().c_str());
+}
+
+void Editor::loop()
+{
+  while (!m_quit)
   {
+    // everything the terminal has sent is handled before drawing once
+    while (!m_quit && pollEvents(0))
+    {
+      processKeypress();
+      m_redraw = true;
+    }
+
+    if (!m_redraw)
+    {
+      pollEvents(-1);
+      continue;
+    }
+
+    // draw at most one frame per interval; keys arriving in the meantime
+    // are folded into it
+    const auto next_frame = m_last_frame + std::chrono::milliseconds(KILO_FRAME_INTERVAL_MS);
+    const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        next_frame - std::chrono::steady_clock::now());
+    if (wait.count() > 0)
+    {
+      pollEvents(static_cast<int>(wait.count()));
+      continue;
+    }
+
     refreshScreen();
+  }
+
+  const char *profile_path = std::getenv("KILO_PROFILE");
+  if (profile_path && *profile_path && !m_profiler.dump(profile_path))
+    terminal_manager::die(profile_path);
+}
+
+bool Editor::runScript(const std::string &filename, std::string &error)
+{
+  m_batch = true;
+  startSession();
+  openBuffer(filename);
+
+  // scrolling after every key keeps the keys that move by pages acting as
+  // they would if typed slowly; nothing is drawn, so the budget is kept here
+  while (!m_quit && m_term->inputPending())
+  {
     processKeypress();
+    scroll();
+    enforceMemoryBudget();
+  }
+
+  for (std::size_t i = 0; i < m_buffers.size(); ++i)
+  {
+    if (!m_buffers[i]->dirty || m_buffers[i]->filename.empty())
+      continue;
+
+    switchBuffer(i);
+    save();
+    if (m_buf->dirty)
+    {
+      error = m_buf->filename + ": " + m_statusmsg;
+      return false;
+    }
   }
+
+  return true;
 }
@@ -1,8 +1,14 @@
 #include "kilo++/EditorUtils.hpp"
 
+#include <algorithm>
 #include <cerrno>
 #include <cstdio>
-#include <cstdlib>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <string_view>
+#include <system_error>
 #include <sys/ioctl.h>
 #include <termios.h>
 #include <unistd.h>
@@ -12,19 +18,48 @@ namespace terminal_manager
 
   termios orig_termios;
 
-  void die(const char *s)
+  // bytes read from the terminal but not decoded into keys yet
+  char input[4096];
+  std::size_t input_begin = 0, input_end = 0;
+  std::string paste;
+
+  // how long the rest of an escape sequence or a paste may take to arrive
+  constexpr int INPUT_TIMEOUT_MS = 100;
+
+  // written to by the SIGWINCH handler, watched by the event loop
+  int resize_pipe[2] = {-1, -1};
+
+  // Waits up to timeout_ms (forever if negative) for input on stdin.
+  bool waitReadable(int timeout_ms)
+  {
+    pollfd fd = {STDIN_FILENO, POLLIN, 0};
+    int ready;
+    while ((ready = poll(&fd, 1, timeout_ms)) == -1)
+    {
+      if (errno != EINTR)
+        die("poll");
+    }
+    return ready > 0;
+  }
+
+  void onResize(int)
   {
-    write(STDOUT_FILENO, "\x1b[2J", 4);
-    write(STDOUT_FILENO, "\x1b[H", 3);
+    const int saved_errno = errno;
+    const char c = 0;
+    write(resize_pipe[1], &c, 1);
+    errno = saved_errno;
+  }
 
-    perror(s);
-    exit(1);
+  void die(const char *s)
+  {
+    throw std::system_error(errno, std::generic_category(), s);
   }
 
+  // Runs while unwinding, so a failure is left alone rather than reported.
   void disableRawMode()
   {
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios) == -1)
-      die("tcsetattr");
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios);
   }
 
   void enableRawMode()
@@ -32,18 +67,20 @@ namespace terminal_manager
     if (tcgetattr(STDIN_FILENO, &orig_termios) == -1)
       die("tcgetattr");
 
-    atexit(disableRawMode);
-
     struct termios raw = orig_termios;
     raw.c_iflag &= ~(BRKINT | ICRNL | ISTRIP | IXON);
     raw.c_oflag &= ~(OPOST);
     raw.c_cflag |= (CS8);
     raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    // reads never wait; poll() does the waiting
     raw.c_cc[VMIN] = 0;
-    raw.c_cc[VTIME] = 1;
+    raw.c_cc[VTIME] = 0;
 
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
       die("tcsetattr");
+
+    // have the terminal mark pasted text so it can be inserted in one go
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
   }
 
   int getCursorPosition(int *rows, int *cols)
@@ -56,7 +93,7 @@ namespace terminal_manager
 
     while (i < sizeof(buf) - 1)
     {
-      if (read(STDIN_FILENO, &buf[i], 1) != 1)
+      if (!waitReadable(INPUT_TIMEOUT_MS) || read(STDIN_FILENO, &buf[i], 1) != 1)
         break;
 
       if (buf[i] == 'R')
@@ -95,89 +132,247 @@ namespace terminal_manager
     }
   }
 
-  int readKey()
+  // Appends whatever the terminal has ready to the buffer, waiting up to
+  // timeout_ms for it; returns false if nothing arrived.
+  bool fillInput(int timeout_ms)
   {
-    int nread;
-    char c;
+    if (input_begin > 0)
+    {
+      std::memmove(input, input + input_begin, input_end - input_begin);
+      input_end -= input_begin;
+      input_begin = 0;
+    }
 
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1)
+    if (input_end == sizeof(input) || !waitReadable(timeout_ms))
+      return false;
+
+    const ssize_t nread = read(STDIN_FILENO, input + input_end, sizeof(input) - input_end);
+    if (nread == -1)
     {
-      if (nread == -1 && errno != EAGAIN)
+      if (errno != EAGAIN && errno != EINTR)
         die("read");
+      return false;
     }
 
-    if (c == '\x1b')
+    input_end += nread;
+    return nread > 0;
+  }
+
+  // Collects the text of a bracketed paste up to its end marker. A
+  // terminal that stops sending without one ends the paste at the timeout.
+  int readPaste()
+  {
+    constexpr std::string_view end_marker = "\x1b[201~";
+    paste.clear();
+
+    while (true)
     {
-      char seq[3];
+      const std::string_view pending(input + input_begin, input_end - input_begin);
+      const auto at = pending.find(end_marker);
+      if (at != std::string_view::npos)
+      {
+        paste.append(pending.substr(0, at));
+        input_begin += at + end_marker.size();
+        break;
+      }
 
-      if (read(STDIN_FILENO, &seq[0], 1) != 1)
-        return '\x1b';
+      // hold back what could be the start of a marker split across reads
+      std::size_t keep = std::min(pending.size(), end_marker.size() - 1);
+      while (keep && pending.substr(pending.size() - keep) != end_marker.substr(0, keep))
+        keep--;
 
-      if (read(STDIN_FILENO, &seq[1], 1) != 1)
-        return '\x1b';
+      paste.append(pending.substr(0, pending.size() - keep));
+      input_begin = input_end - keep;
 
-      if (seq[0] == '[')
+      if (!fillInput(INPUT_TIMEOUT_MS))
       {
-        if (seq[1] >= '0' && seq[1] <= '9')
-        {
-          if (read(STDIN_FILENO, &seq[2], 1) != 1)
-            return '\x1b';
-
-          if (seq[2] == '~')
-          {
-            switch (seq[1])
-            {
-            case '1':
-              return static_cast<int>(EditorKey::HOME_KEY);
-            case '3':
-              return static_cast<int>(EditorKey::DEL_KEY);
-            case '4':
-              return static_cast<int>(EditorKey::END_KEY);
-            case '5':
-              return static_cast<int>(EditorKey::PAGE_UP);
-            case '6':
-              return static_cast<int>(EditorKey::PAGE_DOWN);
-            case '7':
-              return static_cast<int>(EditorKey::HOME_KEY);
-            case '8':
-              return static_cast<int>(EditorKey::END_KEY);
-            }
-          }
-        }
-        else
-        {
-          switch (seq[1])
-          {
-          case 'A':
-            return static_cast<int>(EditorKey::ARROW_UP);
-          case 'B':
-            return static_cast<int>(EditorKey::ARROW_DOWN);
-          case 'C':
-            return static_cast<int>(EditorKey::ARROW_RIGHT);
-          case 'D':
-            return static_cast<int>(EditorKey::ARROW_LEFT);
-          case 'H':
-            return static_cast<int>(EditorKey::HOME_KEY);
-          case 'F':
-            return static_cast<int>(EditorKey::END_KEY);
-          }
-        }
+        paste.append(input + input_begin, input_end - input_begin);
+        input_begin = input_end;
+        break;
       }
-      else if (seq[0] == 'O')
+    }
+
+    return static_cast<int>(EditorKey::PASTE);
+  }
+
+  // Decodes the escape sequence at the start of `seq`, setting `length` to
+  // the bytes it takes; returns 0 if the buffer ends within it.
+  int decodeEscape(std::string_view seq, std::size_t &length)
+  {
+    length = 1;
+    if (seq.size() < 2)
+      return 0;
+
+    if (seq[1] == 'O')
+    {
+      if (seq.size() < 3)
+        return 0;
+
+      length = 3;
+      switch (seq[2])
       {
-        switch (seq[1])
-        {
-        case 'H':
-          return static_cast<int>(EditorKey::HOME_KEY);
-        case 'F':
-          return static_cast<int>(EditorKey::END_KEY);
-        }
+      case 'H':
+        return static_cast<int>(EditorKey::HOME_KEY);
+      case 'F':
+        return static_cast<int>(EditorKey::END_KEY);
       }
+      return '\x1b';
+    }
 
+    if (seq[1] != '[')
       return '\x1b';
+
+    // CSI: parameter bytes up to a final byte in @..~
+    std::size_t end = 2;
+    while (end < seq.size() && seq[end] >= 0x20 && seq[end] < 0x40)
+      end++;
+    if (end == seq.size())
+      return end < 16 ? 0 : '\x1b';
+
+    length = end + 1;
+    const auto params = seq.substr(2, end - 2);
+    if (seq[end] == '~')
+    {
+      if (params == "1" || params == "7")
+        return static_cast<int>(EditorKey::HOME_KEY);
+      if (params == "3")
+        return static_cast<int>(EditorKey::DEL_KEY);
+      if (params == "4" || params == "8")
+        return static_cast<int>(EditorKey::END_KEY);
+      if (params == "5")
+        return static_cast<int>(EditorKey::PAGE_UP);
+      if (params == "6")
+        return static_cast<int>(EditorKey::PAGE_DOWN);
+      if (params == "200")
+        return -1;
+      return '\x1b';
+    }
+
+    switch (seq[end])
+    {
+    case 'A':
+      return static_cast<int>(EditorKey::ARROW_UP);
+    case 'B':
+      return static_cast<int>(EditorKey::ARROW_DOWN);
+    case 'C':
+      return static_cast<int>(EditorKey::ARROW_RIGHT);
+    case 'D':
+      return static_cast<int>(EditorKey::ARROW_LEFT);
+    case 'H':
+      return static_cast<int>(EditorKey::HOME_KEY);
+    case 'F':
+      return static_cast<int>(EditorKey::END_KEY);
+    }
+    return '\x1b';
+  }
+
+  int readKey()
+  {
+    while (input_begin == input_end)
+      fillInput(-1);
+
+    const char c = input[input_begin];
+    if (c != '\x1b')
+    {
+      input_begin++;
+      return c;
+    }
+
+    // the rest of a sequence may still be on its way; a lone escape is
+    // the key itself
+    std::size_t length;
+    int key;
+    while (!(key = decodeEscape(std::string_view(input + input_begin, input_end - input_begin), length)))
+    {
+      if (!fillInput(INPUT_TIMEOUT_MS))
+      {
+        input_begin++;
+        return '\x1b';
+      }
     }
 
-    return c;
+    input_begin += length;
+    return key == -1 ? readPaste() : key;
+  }
+
+  void decodeInput(std::string_view input, std::vector<int> &keys, std::vector<std::string> &pastes)
+  {
+    constexpr std::string_view end_marker = "\x1b[201~";
+
+    while (!input.empty())
+    {
+      if (input[0] != '\x1b')
+      {
+        keys.push_back(input[0]);
+        input.remove_prefix(1);
+        continue;
+      }
+
+      // a sequence cut off by the end of the input is a lone escape, as it
+      // would be once readKey() gave up waiting for the rest
+      std::size_t length;
+      const int key = decodeEscape(input, length);
+      if (!key)
+      {
+        keys.push_back('\x1b');
+        input.remove_prefix(1);
+        continue;
+      }
+
+      input.remove_prefix(length);
+      if (key != -1)
+      {
+        keys.push_back(key);
+        continue;
+      }
+
+      const auto at = std::min(input.find(end_marker), input.size());
+      keys.push_back(static_cast<int>(EditorKey::PASTE));
+      pastes.emplace_back(input.substr(0, at));
+      input.remove_prefix(std::min(at + end_marker.size(), input.size()));
+    }
+  }
+
+  bool inputPending()
+  {
+    return input_begin < input_end;
+  }
+
+  const std::string &pastedText()
+  {
+    return paste;
+  }
+
+  int resizeFd()
+  {
+    if (resize_pipe[0] != -1)
+      return resize_pipe[0];
+
+    if (pipe(resize_pipe) == -1)
+      die("pipe");
+
+    for (const int fd : resize_pipe)
+    {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    struct sigaction sa = {};
+    sa.sa_handler = onResize;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGWINCH, &sa, nullptr) == -1)
+      die("sigaction");
+
+    return resize_pipe[0];
+  }
+
+  bool takeResize()
+  {
+    char buf[64];
+    bool resized = false;
+    while (read(resize_pipe[0], buf, sizeof(buf)) > 0)
+      resized = true;
+    return resized;
   }
 
 } // namespace terminal_manager
@@ -0,0 +1,229 @@
+#include "kilo++/FileSource.hpp"
+#include "kilo++/ThreadPool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <numeric>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KILO_INDEX_X86 1
+#endif
+
+// bytes of the file each thread scans for newlines at a time
+#define KILO_INDEX_CHUNK (4 << 20)
+
+/*** newline scan ***/
+
+namespace
+{
+  // Calls fn with the offset of every newline in [begin, end), 32 bytes at
+  // a time where the vector unit allows.
+  template <typename Fn>
+  void forEachNewline(const char *data, std::size_t begin, std::size_t end, Fn &fn)
+  {
+    std::size_t i = begin;
+#ifdef KILO_INDEX_X86
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; i + 32 <= end; i += 32)
+    {
+      const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+      const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 16));
+      auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(lo, nl))) |
+                  static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(hi, nl))) << 16;
+      fn.block(i, mask);
+    }
+#endif
+    for (; i < end; ++i)
+    {
+      if (data[i] == '\n')
+        fn.block(i, 1);
+    }
+  }
+
+  struct CountNewlines
+  {
+    std::size_t count = 0;
+
+    void block(std::size_t, uint32_t mask)
+    {
+      count += __builtin_popcount(mask);
+    }
+  };
+
+  // Writes the line start after every newline seen, in order.
+  struct StoreLineStarts
+  {
+    uint64_t *out;
+
+    void block(std::size_t at, uint32_t mask)
+    {
+      for (; mask; mask &= mask - 1)
+        *out++ = at + __builtin_ctz(mask) + 1;
+    }
+  };
+}
+
+/*** file source ***/
+
+std::shared_ptr<FileSource> FileSource::open(const std::string &path, bool growable)
+{
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return nullptr;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1)
+  {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return nullptr;
+  }
+
+  std::shared_ptr<FileSource> source(new FileSource());
+  source->m_size = static_cast<std::size_t>(st.st_size);
+
+  // mmap() rejects zero-length mappings; an empty file simply has no lines
+  if (source->m_size > 0)
+  {
+    void *data = mmap(nullptr, source->m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+      int saved_errno = errno;
+      close(fd);
+      errno = saved_errno;
+      return nullptr;
+    }
+    source->m_data = static_cast<const char *>(data);
+  }
+
+  // the mapping keeps the file contents alive, even if it is later replaced
+  if (growable)
+    source->m_fd = fd;
+  else
+    close(fd);
+
+  source->indexLines(0);
+  return source;
+}
+
+FileSource::~FileSource()
+{
+  if (m_data)
+    munmap(const_cast<char *>(m_data), m_size);
+  if (m_fd != -1)
+    close(m_fd);
+}
+
+std::size_t FileSource::lineCount() const
+{
+  return m_line_starts.size();
+}
+
+std::size_t FileSource::indexBytes() const
+{
+  return m_line_starts.capacity() * sizeof(uint64_t);
+}
+
+std::string_view FileSource::line(std::size_t index) const
+{
+  const std::size_t start = m_line_starts[index];
+  std::size_t end = index + 1 < m_line_starts.size() ? m_line_starts[index + 1] : m_size;
+
+  while (end > start && (m_data[end - 1] == '\n' || m_data[end - 1] == '\r'))
+    end--;
+
+  return std::string_view(m_data + start, end - start);
+}
+
+std::size_t FileSource::bytes() const
+{
+  return m_size;
+}
+
+bool FileSource::grow()
+{
+  struct stat st;
+  if (m_fd == -1 || fstat(m_fd, &st) == -1 || static_cast<std::size_t>(st.st_size) < m_size)
+    return false;
+
+  const auto size = static_cast<std::size_t>(st.st_size);
+  if (size == m_size)
+    return true;
+
+  // the mapping is extended in place when it can be and moved when not;
+  // nothing holds on to line views across a call
+  void *data = m_data ? mremap(const_cast<char *>(m_data), m_size, size, MREMAP_MAYMOVE)
+                      : mmap(nullptr, size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+  if (data == MAP_FAILED)
+    return false;
+
+  const auto from = m_size;
+  m_data = static_cast<const char *>(data);
+  m_size = size;
+  indexLines(from);
+  return true;
+}
+
+void FileSource::indexLines(std::size_t from)
+{
+  if (!m_data)
+    return;
+
+  madvise(const_cast<char *>(m_data), m_size, MADV_SEQUENTIAL);
+
+  // same line splitting as std::getline: a trailing newline does not start a new line
+  std::size_t pos = from;
+  if (from > 0 && m_data[from - 1] != '\n')
+  {
+    const void *nl = std::memchr(m_data + from, '\n', m_size - from);
+    pos = nl ? static_cast<const char *>(nl) - m_data + 1 : m_size;
+  }
+
+  if (pos < m_size)
+  {
+    // every chunk counts its newlines, so each knows where its line starts
+    // go, then fills them in; a newline in the last byte starts nothing
+    const std::size_t last = m_size - 1;
+    const std::size_t chunks = (last - pos + KILO_INDEX_CHUNK - 1) / KILO_INDEX_CHUNK;
+    const auto range = [&](std::size_t chunk)
+    {
+      const auto begin = pos + chunk * KILO_INDEX_CHUNK;
+      return std::make_pair(begin, std::min(begin + KILO_INDEX_CHUNK, last));
+    };
+
+    std::vector<std::size_t> offsets(chunks + 1, 0);
+    ThreadPool::shared().parallelFor(chunks, 1, [&](std::size_t begin, std::size_t end)
+                                     {
+                                       for (auto chunk = begin; chunk < end; ++chunk)
+                                       {
+                                         CountNewlines counter;
+                                         const auto [first, limit] = range(chunk);
+                                         forEachNewline(m_data, first, limit, counter);
+                                         offsets[chunk + 1] = counter.count;
+                                       }
+                                     });
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+    const auto base = m_line_starts.size() + 1;
+    m_line_starts.resize(base + offsets.back());
+    m_line_starts[base - 1] = pos;
+    ThreadPool::shared().parallelFor(chunks, 1, [&](std::size_t begin, std::size_t end)
+                                     {
+                                       for (auto chunk = begin; chunk < end; ++chunk)
+                                       {
+                                         StoreLineStarts store = {m_line_starts.data() + base + offsets[chunk]};
+                                         const auto [first, limit] = range(chunk);
+                                         forEachNewline(m_data, first, limit, store);
+                                       }
+                                     });
+  }
+
+  madvise(const_cast<char *>(m_data), m_size, MADV_NORMAL);
+}
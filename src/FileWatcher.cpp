@@ -0,0 +1,50 @@
+#include "kilo++/FileWatcher.hpp"
+
+#include <cerrno>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+FileWatcher::~FileWatcher()
+{
+  stop();
+}
+
+bool FileWatcher::watch(const std::string &path)
+{
+  stop();
+
+  m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_fd == -1)
+    return false;
+
+  if (inotify_add_watch(m_fd, path.c_str(), IN_MODIFY) == -1)
+  {
+    const int saved_errno = errno;
+    stop();
+    errno = saved_errno;
+    return false;
+  }
+  return true;
+}
+
+void FileWatcher::stop()
+{
+  if (m_fd != -1)
+    close(m_fd);
+  m_fd = -1;
+}
+
+int FileWatcher::fd() const
+{
+  return m_fd;
+}
+
+bool FileWatcher::takeChanges()
+{
+  // the events only say that something changed; the file itself says what
+  alignas(inotify_event) char buf[4096];
+  bool changed = false;
+  while (m_fd != -1 && read(m_fd, buf, sizeof(buf)) > 0)
+    changed = true;
+  return changed;
+}
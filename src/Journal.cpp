@@ -0,0 +1,310 @@
+#include "kilo++/Journal.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// how long edits gather before they are written out together
+#define KILO_JOURNAL_FLUSH_MS 200
+// queued bytes that get written without waiting for the interval
+#define KILO_JOURNAL_BATCH_BYTES (1 << 20)
+
+// A swap file is a header naming the version of the file it applies to,
+// then one record per edit: op, row, col and text length, the text, and a
+// checksum of all of it, so a record torn by a crash is recognised.
+namespace
+{
+  constexpr char MAGIC[8] = {'K', 'I', 'L', 'O', 'S', 'W', 'P', '1'};
+  constexpr std::size_t HEADER_SIZE = sizeof(MAGIC) + 4 * sizeof(uint64_t);
+  constexpr std::size_t RECORD_HEAD = 1 + 3 * sizeof(uint32_t);
+  constexpr std::size_t RECORD_TAIL = sizeof(uint32_t);
+
+  // FNV-1a
+  uint32_t checksum(const char *data, std::size_t size)
+  {
+    uint32_t hash = 2166136261u;
+    for (std::size_t i = 0; i < size; ++i)
+      hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+    return hash;
+  }
+
+  template <typename T>
+  void put(std::string &out, T value)
+  {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+
+  template <typename T>
+  T get(const char *p)
+  {
+    T value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+  }
+
+  bool writeAll(int fd, const char *data, std::size_t size)
+  {
+    while (size)
+    {
+      const ssize_t written = ::write(fd, data, size);
+      if (written == -1)
+      {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      data += written;
+      size -= written;
+    }
+    return true;
+  }
+
+  bool readFile(const std::string &path, std::string &out)
+  {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+      return false;
+
+    char buf[65536];
+    ssize_t nread;
+    while ((nread = read(fd, buf, sizeof(buf))) != 0)
+    {
+      if (nread == -1)
+      {
+        if (errno == EINTR)
+          continue;
+        close(fd);
+        return false;
+      }
+      out.append(buf, nread);
+    }
+
+    close(fd);
+    return true;
+  }
+}
+
+Journal::Journal() = default;
+
+Journal::~Journal()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_one();
+  if (m_thread.joinable())
+    m_thread.join();
+
+  if (m_fd != -1)
+    close(m_fd);
+}
+
+std::string Journal::swapPath(const std::string &path)
+{
+  return path + ".kilo-swap";
+}
+
+Journal::Recovery Journal::open(const std::string &path, const ApplyFn &apply)
+{
+  // a journal never opened, like those of scripted edits, has nothing to
+  // write and so no thread
+  if (!m_thread.joinable())
+    m_thread = std::thread(&Journal::run, this);
+
+  discard();
+
+  Recovery recovery;
+  std::lock_guard<std::mutex> io(m_io_mutex);
+  m_path = path;
+  m_swap_path = swapPath(path);
+  m_failed = !identify(m_path, m_identity);
+  if (m_failed)
+    return recovery;
+
+  std::string data;
+  if (!readFile(m_swap_path, data))
+    return recovery;
+
+  // a crash right after creating the file leaves less than a header
+  if (data.size() < HEADER_SIZE)
+  {
+    unlink(m_swap_path.c_str());
+    return recovery;
+  }
+
+  const char *p = data.data() + sizeof(MAGIC);
+  if (std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0 ||
+      get<uint64_t>(p) != m_identity.device ||
+      get<uint64_t>(p + 8) != m_identity.inode ||
+      get<uint64_t>(p + 16) != m_identity.size ||
+      get<int64_t>(p + 24) != m_identity.mtime_ns)
+  {
+    // recorded against a file that has changed since; keep it for the user
+    rename(m_swap_path.c_str(), (m_swap_path + ".stale").c_str());
+    recovery.stale = true;
+    return recovery;
+  }
+
+  std::size_t pos = HEADER_SIZE;
+  m_replaying = true;
+  while (pos + RECORD_HEAD + RECORD_TAIL <= data.size())
+  {
+    const char *record = data.data() + pos;
+    const auto op = static_cast<unsigned char>(record[0]);
+    const auto row = get<uint32_t>(record + 1);
+    const auto col = get<uint32_t>(record + 5);
+    const auto length = get<uint32_t>(record + 9);
+    const std::size_t size = RECORD_HEAD + length + RECORD_TAIL;
+    if (op > static_cast<unsigned char>(UndoLog::Op::JOIN_ROWS) || size > data.size() - pos ||
+        get<uint32_t>(record + RECORD_HEAD + length) != checksum(record, RECORD_HEAD + length))
+      break;
+
+    if (!apply(static_cast<UndoLog::Op>(op), row, col, std::string_view(record + RECORD_HEAD, length)))
+      break;
+
+    pos += size;
+    recovery.edits++;
+  }
+  m_replaying = false;
+
+  // carry on after the last good record
+  const int fd = ::open(m_swap_path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd == -1 || ftruncate(fd, pos) == -1 || lseek(fd, 0, SEEK_END) == -1)
+  {
+    if (fd != -1)
+      close(fd);
+    m_failed = true;
+    return recovery;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_fd = fd;
+  m_fd_generation = m_generation;
+  return recovery;
+}
+
+void Journal::append(UndoLog::Op op, int row, int col, std::string_view text)
+{
+  if (m_replaying || m_failed || m_path.empty())
+    return;
+
+  bool wake;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto start = m_pending.size();
+    m_pending += static_cast<char>(op);
+    put(m_pending, static_cast<uint32_t>(row));
+    put(m_pending, static_cast<uint32_t>(col));
+    put(m_pending, static_cast<uint32_t>(text.size()));
+    m_pending += text;
+    put(m_pending, checksum(m_pending.data() + start, m_pending.size() - start));
+    wake = start == 0 || m_pending.size() >= KILO_JOURNAL_BATCH_BYTES;
+  }
+
+  if (wake)
+    m_cv.notify_one();
+}
+
+void Journal::discard()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending.clear();
+    m_generation++;
+  }
+
+  std::lock_guard<std::mutex> io(m_io_mutex);
+  if (m_fd != -1)
+  {
+    close(m_fd);
+    m_fd = -1;
+  }
+
+  if (!m_path.empty())
+  {
+    unlink(m_swap_path.c_str());
+    // the edits to come apply to what is on disk now
+    m_failed = !identify(m_path, m_identity);
+  }
+}
+
+bool Journal::identify(const std::string &path, Identity &identity)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) == -1)
+    return false;
+
+  identity.device = st.st_dev;
+  identity.inode = st.st_ino;
+  identity.size = st.st_size;
+  identity.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+void Journal::run()
+{
+  std::string batch;
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true)
+  {
+    m_cv.wait(lock, [this]
+              { return m_stop || !m_pending.empty(); });
+
+    // group commit: let the edits of one interval gather into one write
+    m_cv.wait_for(lock, std::chrono::milliseconds(KILO_JOURNAL_FLUSH_MS), [this]
+                  { return m_stop || m_pending.size() >= KILO_JOURNAL_BATCH_BYTES; });
+
+    if (m_pending.empty())
+    {
+      if (m_stop)
+        return;
+      continue;
+    }
+
+    batch.swap(m_pending);
+    const auto generation = m_generation;
+    lock.unlock();
+
+    if (!write(batch, generation))
+      m_failed = true;
+    batch.clear();
+
+    lock.lock();
+  }
+}
+
+bool Journal::write(const std::string &batch, uint64_t generation)
+{
+  std::lock_guard<std::mutex> io(m_io_mutex);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (generation != m_generation)
+      return true;
+  }
+
+  if (m_fd == -1 || m_fd_generation != generation)
+  {
+    if (m_fd != -1)
+      close(m_fd);
+
+    m_fd = ::open(m_swap_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (m_fd == -1)
+      return false;
+    m_fd_generation = generation;
+
+    std::string header(MAGIC, sizeof(MAGIC));
+    put(header, m_identity.device);
+    put(header, m_identity.inode);
+    put(header, m_identity.size);
+    put(header, m_identity.mtime_ns);
+    if (!writeAll(m_fd, header.data(), header.size()))
+      return false;
+  }
+
+  return writeAll(m_fd, batch.data(), batch.size()) && fdatasync(m_fd) == 0;
+}
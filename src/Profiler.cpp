@@ -0,0 +1,127 @@
+#include "kilo++/Profiler.hpp"
+#include "kilo++/AtomicFile.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+
+namespace
+{
+  constexpr const char *NAMES[] = {"keypress", "updateRow", "updateSyntax", "findCallback", "drawRows", "write"};
+  // names short enough for the message bar
+  constexpr const char *SHORT_NAMES[] = {"key", "row", "hl", "find", "draw", "out"};
+
+  void appendNumber(std::string &s, uint64_t n)
+  {
+    char digits[24];
+    const auto end = std::to_chars(digits, digits + sizeof(digits), n).ptr;
+    s.append(digits, end - digits);
+  }
+}
+
+bool Profiler::enabled() const
+{
+  return m_enabled;
+}
+
+void Profiler::setEnabled(bool enabled)
+{
+  m_enabled = enabled;
+}
+
+void Profiler::record(Section section, uint64_t ns)
+{
+  auto &histogram = m_histograms[section];
+  histogram.buckets[bucketOf(ns)]++;
+  histogram.count++;
+  histogram.total += ns;
+  histogram.max = std::max(histogram.max, ns);
+}
+
+uint64_t Profiler::count(Section section) const
+{
+  return m_histograms[section].count;
+}
+
+uint64_t Profiler::percentile(Section section, double fraction) const
+{
+  const auto &histogram = m_histograms[section];
+  if (histogram.count == 0)
+    return 0;
+
+  // the sample of that rank is reported as the end of its bucket
+  const auto rank = static_cast<uint64_t>(fraction * (histogram.count - 1)) + 1;
+  uint64_t seen = 0;
+  for (std::size_t b = 0; b < BUCKETS; ++b)
+  {
+    seen += histogram.buckets[b];
+    if (seen >= rank)
+      return std::min(bucketStart(b + 1) - 1, histogram.max);
+  }
+  return histogram.max;
+}
+
+const char *Profiler::name(Section section)
+{
+  return NAMES[section];
+}
+
+void Profiler::appendSummary(std::string &s, std::size_t width) const
+{
+  const auto start = s.size();
+  s += "us p50/p99:";
+  for (std::size_t i = 0; i < SECTION_COUNT; ++i)
+  {
+    const auto section = static_cast<Section>(i);
+    s += ' ';
+    s += SHORT_NAMES[i];
+    s += ' ';
+    appendNumber(s, percentile(section, 0.5) / 1000);
+    s += '/';
+    appendNumber(s, percentile(section, 0.99) / 1000);
+  }
+
+  if (s.size() - start > width)
+    s.resize(start + width);
+}
+
+bool Profiler::dump(const std::string &path) const
+{
+  std::string out = "section          count      p50_us      p90_us      p99_us      max_us     mean_us\n";
+  char line[160];
+  for (std::size_t i = 0; i < SECTION_COUNT; ++i)
+  {
+    const auto section = static_cast<Section>(i);
+    const auto &histogram = m_histograms[i];
+    const double mean = histogram.count ? static_cast<double>(histogram.total) / histogram.count : 0.0;
+    std::snprintf(line, sizeof(line), "%-12s %9llu %11.1f %11.1f %11.1f %11.1f %11.1f\n",
+                  NAMES[i], static_cast<unsigned long long>(histogram.count),
+                  percentile(section, 0.5) / 1000.0, percentile(section, 0.9) / 1000.0,
+                  percentile(section, 0.99) / 1000.0, histogram.max / 1000.0, mean / 1000.0);
+    out += line;
+  }
+
+  AtomicFile file(path);
+  return file.open() && file.append(out) && file.commit();
+}
+
+// Values below 4 get a bucket each; above that every power of two is split
+// into four by the two bits after the leading one.
+std::size_t Profiler::bucketOf(uint64_t ns)
+{
+  if (ns < 4)
+    return ns;
+
+  const int msb = 63 - __builtin_clzll(ns);
+  const auto bucket = static_cast<std::size_t>(msb - 1) * 4 + ((ns >> (msb - 2)) & 3);
+  return std::min(bucket, BUCKETS - 1);
+}
+
+uint64_t Profiler::bucketStart(std::size_t bucket)
+{
+  if (bucket < 4)
+    return bucket;
+
+  const int msb = static_cast<int>(bucket / 4) + 1;
+  return (4 + bucket % 4) << (msb - 2);
+}
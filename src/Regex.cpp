@@ -0,0 +1,631 @@
+#include "kilo++/Regex.hpp"
+#include "kilo++/Search.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <utility>
+
+// cached DFA states per matcher before the caches are thrown away
+#define KILO_REGEX_MAX_STATES 2048
+
+/*** parser ***/
+
+namespace
+{
+  struct Node
+  {
+    enum class Kind
+    {
+      EMPTY,
+      CLASS,
+      CONCAT,
+      ALT,
+      STAR,
+      PLUS,
+      QUEST,
+      BEGIN,
+      END
+    };
+
+    Kind kind = Kind::EMPTY;
+    std::bitset<256> cls;
+    std::vector<Node> kids;
+  };
+
+  class Parser
+  {
+  public:
+    explicit Parser(const std::string &pattern) : m_pattern(pattern) {}
+
+    bool parse(Node &node, std::string &error)
+    {
+      node = parseAlt();
+      if (m_error.empty() && m_pos < m_pattern.size())
+        m_error = "unmatched )";
+
+      error = m_error;
+      return m_error.empty();
+    }
+
+  private:
+    bool atEnd() const { return m_pos >= m_pattern.size(); }
+
+    char peek() const { return m_pattern[m_pos]; }
+
+    Node parseAlt()
+    {
+      Node alt;
+      alt.kind = Node::Kind::ALT;
+      alt.kids.push_back(parseConcat());
+      while (m_error.empty() && !atEnd() && peek() == '|')
+      {
+        m_pos++;
+        alt.kids.push_back(parseConcat());
+      }
+
+      if (alt.kids.size() == 1)
+        return std::move(alt.kids.front());
+      return alt;
+    }
+
+    Node parseConcat()
+    {
+      Node concat;
+      concat.kind = Node::Kind::CONCAT;
+      while (m_error.empty() && !atEnd() && peek() != '|' && peek() != ')')
+        concat.kids.push_back(parseRepeat());
+
+      if (concat.kids.empty())
+        return Node();
+      if (concat.kids.size() == 1)
+        return std::move(concat.kids.front());
+      return concat;
+    }
+
+    Node parseRepeat()
+    {
+      if (peek() == '*' || peek() == '+' || peek() == '?')
+      {
+        m_error = "nothing to repeat";
+        return Node();
+      }
+
+      Node node = parseAtom();
+      while (m_error.empty() && !atEnd() && (peek() == '*' || peek() == '+' || peek() == '?'))
+      {
+        Node repeat;
+        repeat.kind = peek() == '*'   ? Node::Kind::STAR
+                      : peek() == '+' ? Node::Kind::PLUS
+                                      : Node::Kind::QUEST;
+        repeat.kids.push_back(std::move(node));
+        node = std::move(repeat);
+        m_pos++;
+      }
+      return node;
+    }
+
+    Node parseAtom()
+    {
+      Node node;
+      const char c = m_pattern[m_pos++];
+      switch (c)
+      {
+      case '(':
+        node = parseAlt();
+        if (atEnd() || peek() != ')')
+        {
+          if (m_error.empty())
+            m_error = "missing )";
+          return Node();
+        }
+        m_pos++;
+        return node;
+      case '[':
+        node.kind = Node::Kind::CLASS;
+        parseBracket(node.cls);
+        return node;
+      case '.':
+        node.kind = Node::Kind::CLASS;
+        node.cls.set();
+        return node;
+      case '^':
+        node.kind = Node::Kind::BEGIN;
+        return node;
+      case '$':
+        node.kind = Node::Kind::END;
+        return node;
+      case '\\':
+      {
+        node.kind = Node::Kind::CLASS;
+        const int single = parseEscape(node.cls);
+        if (single >= 0)
+          node.cls.set(single);
+        return node;
+      }
+      default:
+        node.kind = Node::Kind::CLASS;
+        node.cls.set(static_cast<unsigned char>(c));
+        return node;
+      }
+    }
+
+    // Reads the character after a backslash. Class escapes such as \d are
+    // added to `cls` and return -1, anything else returns the character.
+    int parseEscape(std::bitset<256> &cls)
+    {
+      if (atEnd())
+      {
+        m_error = "trailing \\";
+        return -1;
+      }
+
+      const char c = m_pattern[m_pos++];
+      const auto lower = std::tolower(static_cast<unsigned char>(c));
+      if (lower == 'd' || lower == 'w' || lower == 's')
+      {
+        std::bitset<256> set;
+        for (int b = 0; b < 256; ++b)
+        {
+          if ((lower == 'd' && std::isdigit(b)) ||
+              (lower == 'w' && (std::isalnum(b) || b == '_')) ||
+              (lower == 's' && std::isspace(b)))
+            set.set(b);
+        }
+        cls |= std::isupper(static_cast<unsigned char>(c)) ? ~set : set;
+        return -1;
+      }
+
+      return static_cast<unsigned char>(c == 't' ? '\t' : c);
+    }
+
+    // One bracket item's character, or -1 if it was a class escape.
+    int parseBracketChar(std::bitset<256> &cls)
+    {
+      if (peek() != '\\')
+        return static_cast<unsigned char>(m_pattern[m_pos++]);
+
+      m_pos++;
+      return parseEscape(cls);
+    }
+
+    void parseBracket(std::bitset<256> &cls)
+    {
+      bool negate = false;
+      if (!atEnd() && peek() == '^')
+      {
+        negate = true;
+        m_pos++;
+      }
+
+      bool first = true;
+      while (m_error.empty())
+      {
+        if (atEnd())
+        {
+          m_error = "missing ]";
+          return;
+        }
+        if (peek() == ']' && !first)
+          break;
+        first = false;
+
+        const int lo = parseBracketChar(cls);
+        if (lo < 0)
+          continue;
+
+        int hi = lo;
+        if (m_pos + 1 < m_pattern.size() && peek() == '-' && m_pattern[m_pos + 1] != ']')
+        {
+          m_pos++;
+          hi = parseBracketChar(cls);
+          if (hi < lo)
+          {
+            if (m_error.empty())
+              m_error = "bad range";
+            return;
+          }
+        }
+
+        for (int b = lo; b <= hi; ++b)
+          cls.set(b);
+      }
+      m_pos++;
+
+      if (negate)
+        cls.flip();
+    }
+
+    const std::string &m_pattern;
+    std::size_t m_pos = 0;
+    std::string m_error;
+  };
+
+  // Mirrors the pattern so it matches the reversed text: sequences run
+  // backwards and the two anchors trade places.
+  void reverseNode(Node &node)
+  {
+    if (node.kind == Node::Kind::CONCAT)
+      std::reverse(node.kids.begin(), node.kids.end());
+    else if (node.kind == Node::Kind::BEGIN)
+      node.kind = Node::Kind::END;
+    else if (node.kind == Node::Kind::END)
+      node.kind = Node::Kind::BEGIN;
+
+    for (auto &kid : node.kids)
+      reverseNode(kid);
+  }
+
+  // Longest literal that appears in every match of the node.
+  std::string findRequiredLiteral(const Node &node)
+  {
+    switch (node.kind)
+    {
+    case Node::Kind::CLASS:
+    {
+      if (node.cls.count() != 1)
+        return "";
+
+      int b = 0;
+      while (!node.cls.test(b))
+        b++;
+      return std::string(1, static_cast<char>(b));
+    }
+    case Node::Kind::PLUS:
+      return findRequiredLiteral(node.kids.front());
+    case Node::Kind::CONCAT:
+    {
+      // runs of single characters join up, anything else is checked alone
+      std::string best, run;
+      for (const auto &kid : node.kids)
+      {
+        if (kid.kind == Node::Kind::CLASS && kid.cls.count() == 1)
+        {
+          run += findRequiredLiteral(kid);
+          continue;
+        }
+
+        if (run.size() > best.size())
+          best = run;
+        run.clear();
+
+        auto inner = findRequiredLiteral(kid);
+        if (inner.size() > best.size())
+          best = std::move(inner);
+      }
+      return run.size() > best.size() ? run : best;
+    }
+    default:
+      return "";
+    }
+  }
+
+  /*** compiler ***/
+
+  class Compiler
+  {
+  public:
+    explicit Compiler(Regex::Program &program) : m_program(program) {}
+
+    void compile(const Node &node)
+    {
+      emit(node);
+      add(Regex::Op::MATCH);
+    }
+
+  private:
+    int add(Regex::Op op, int x = 0, int y = 0)
+    {
+      m_program.insts.push_back({op, x, y});
+      return static_cast<int>(m_program.insts.size()) - 1;
+    }
+
+    int pc() const { return static_cast<int>(m_program.insts.size()); }
+
+    void emit(const Node &node)
+    {
+      switch (node.kind)
+      {
+      case Node::Kind::EMPTY:
+        break;
+      case Node::Kind::CLASS:
+        m_program.classes.push_back(node.cls);
+        add(Regex::Op::CLASS, static_cast<int>(m_program.classes.size()) - 1);
+        break;
+      case Node::Kind::CONCAT:
+        for (const auto &kid : node.kids)
+          emit(kid);
+        break;
+      case Node::Kind::ALT:
+      {
+        std::vector<int> jumps;
+        for (std::size_t i = 0; i < node.kids.size(); ++i)
+        {
+          if (i + 1 == node.kids.size())
+          {
+            emit(node.kids[i]);
+            break;
+          }
+
+          const int split = add(Regex::Op::SPLIT, pc() + 1);
+          emit(node.kids[i]);
+          jumps.push_back(add(Regex::Op::JMP));
+          m_program.insts[split].y = pc();
+        }
+        for (const int jump : jumps)
+          m_program.insts[jump].x = pc();
+        break;
+      }
+      case Node::Kind::STAR:
+      {
+        const int split = add(Regex::Op::SPLIT, pc() + 1);
+        emit(node.kids.front());
+        add(Regex::Op::JMP, split);
+        m_program.insts[split].y = pc();
+        break;
+      }
+      case Node::Kind::PLUS:
+      {
+        const int body = pc();
+        emit(node.kids.front());
+        add(Regex::Op::SPLIT, body, pc() + 1);
+        break;
+      }
+      case Node::Kind::QUEST:
+      {
+        const int split = add(Regex::Op::SPLIT, pc() + 1);
+        emit(node.kids.front());
+        m_program.insts[split].y = pc();
+        break;
+      }
+      case Node::Kind::BEGIN:
+        add(Regex::Op::ASSERT_BEGIN);
+        break;
+      case Node::Kind::END:
+        add(Regex::Op::ASSERT_END);
+        break;
+      }
+    }
+
+    Regex::Program &m_program;
+  };
+}
+
+std::shared_ptr<const Regex> Regex::compile(const std::string &pattern, std::string &error)
+{
+  Node node;
+  if (!Parser(pattern).parse(node, error))
+    return nullptr;
+
+  auto regex = std::make_shared<Regex>();
+  regex->m_literal = findRequiredLiteral(node);
+  Compiler(regex->m_forward).compile(node);
+  reverseNode(node);
+  Compiler(regex->m_reverse).compile(node);
+  return regex;
+}
+
+/*** lazy DFA ***/
+
+RegexDfa::RegexDfa(const Regex::Program &program, bool unanchored)
+    : m_program(program), m_unanchored(unanchored)
+{
+  reset();
+}
+
+int RegexDfa::start(bool at_begin)
+{
+  return m_start[at_begin];
+}
+
+int RegexDfa::addTransition(int state, unsigned char c)
+{
+  std::vector<int> insts;
+  for (const int pc : m_insts[state])
+  {
+    const auto &inst = m_program.insts[pc];
+    if (inst.op == Regex::Op::CLASS && m_program.classes[inst.x].test(c))
+      insts.push_back(pc + 1);
+  }
+  closure(insts, false, false);
+
+  // an unanchored search may start a new match at every byte
+  if (m_unanchored)
+    insts.insert(insts.end(), m_start_mid.begin(), m_start_mid.end());
+
+  const int id = intern(std::move(insts));
+  m_next[static_cast<std::size_t>(state) * 256 + c] = id;
+  return id;
+}
+
+std::size_t RegexDfa::stateCount() const
+{
+  return m_insts.size();
+}
+
+void RegexDfa::reset()
+{
+  m_insts.clear();
+  m_accept.clear();
+  m_next.clear();
+  m_ids.clear();
+
+  intern({});
+
+  m_start_mid = {0};
+  closure(m_start_mid, false, false);
+
+  std::vector<int> start_begin = {0};
+  closure(start_begin, true, false);
+
+  m_start[0] = intern(m_start_mid);
+  m_start[1] = intern(std::move(start_begin));
+}
+
+// Expands `insts` to every instruction reachable without consuming a byte.
+// Only byte-consuming instructions, MATCH and a `$` that may still hold at
+// the end of the line are kept, sorted so equal sets compare equal.
+void RegexDfa::closure(std::vector<int> &insts, bool at_begin, bool at_end) const
+{
+  std::vector<char> seen(m_program.insts.size(), 0);
+  std::vector<int> stack(insts.rbegin(), insts.rend());
+  insts.clear();
+
+  while (!stack.empty())
+  {
+    const int pc = stack.back();
+    stack.pop_back();
+    if (seen[pc])
+      continue;
+    seen[pc] = 1;
+
+    const auto &inst = m_program.insts[pc];
+    switch (inst.op)
+    {
+    case Regex::Op::SPLIT:
+      stack.push_back(inst.y);
+      stack.push_back(inst.x);
+      break;
+    case Regex::Op::JMP:
+      stack.push_back(inst.x);
+      break;
+    case Regex::Op::ASSERT_BEGIN:
+      if (at_begin)
+        stack.push_back(pc + 1);
+      break;
+    case Regex::Op::ASSERT_END:
+      if (at_end)
+        stack.push_back(pc + 1);
+      else
+        insts.push_back(pc);
+      break;
+    case Regex::Op::CLASS:
+    case Regex::Op::MATCH:
+      insts.push_back(pc);
+      break;
+    }
+  }
+
+  std::sort(insts.begin(), insts.end());
+  insts.erase(std::unique(insts.begin(), insts.end()), insts.end());
+}
+
+int RegexDfa::intern(std::vector<int> insts)
+{
+  std::sort(insts.begin(), insts.end());
+  insts.erase(std::unique(insts.begin(), insts.end()), insts.end());
+
+  const auto found = m_ids.find(insts);
+  if (found != m_ids.end())
+    return found->second;
+
+  unsigned char accept = 0;
+  std::vector<int> at_end = insts;
+  closure(at_end, false, true);
+  for (const int pc : insts)
+    accept |= m_program.insts[pc].op == Regex::Op::MATCH ? ACCEPT : 0;
+  for (const int pc : at_end)
+    accept |= m_program.insts[pc].op == Regex::Op::MATCH ? ACCEPT_AT_END : 0;
+
+  const int id = static_cast<int>(m_insts.size());
+  m_insts.push_back(insts);
+  m_accept.push_back(accept);
+  m_next.resize(m_next.size() + 256, -1);
+  m_ids.emplace(std::move(insts), id);
+  return id;
+}
+
+/*** matcher ***/
+
+RegexMatcher::RegexMatcher(const Regex &regex)
+    : m_search(regex.forward(), true),
+      m_forward(regex.forward(), false),
+      m_reverse(regex.reverse(), true),
+      m_literal(regex.requiredLiteral())
+{
+}
+
+bool RegexMatcher::hasMatch(std::string_view line)
+{
+  if (m_search.stateCount() + m_forward.stateCount() + m_reverse.stateCount() > KILO_REGEX_MAX_STATES)
+  {
+    m_search.reset();
+    m_forward.reset();
+    m_reverse.reset();
+  }
+
+  // the literal rejects most lines far faster than the automaton; lines
+  // that have it go straight on to the exact passes
+  if (!m_literal.empty())
+    return findSubstring(line, m_literal) != std::string_view::npos;
+
+  const std::size_t n = line.size();
+  int state = m_search.start(true);
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    if (m_search.accepts(state, false))
+      return true;
+    state = m_search.next(state, static_cast<unsigned char>(line[i]));
+  }
+  return m_search.accepts(state, true);
+}
+
+// Also forgets what the runs of the previous line found.
+void RegexMatcher::markStarts(std::string_view line)
+{
+  // the reversed pattern accepting at position i means some match of the
+  // pattern starts at i
+  const std::size_t n = line.size();
+  m_starts.assign(n + 1, 0);
+  m_run_heads.assign(n + 1, -1);
+  m_run_ends.clear();
+
+  int state = m_reverse.start(true);
+  m_starts[n] = m_reverse.accepts(state, n == 0);
+  for (std::size_t i = n; i-- > 0;)
+  {
+    state = m_reverse.next(state, static_cast<unsigned char>(line[i]));
+    m_starts[i] = m_reverse.accepts(state, i == 0);
+  }
+}
+
+// End of the longest match starting at `from`, or -1 if there is none.
+int RegexMatcher::longestMatch(std::string_view line, std::size_t from)
+{
+  const std::size_t n = line.size();
+
+  // m_path[k] is the state at position from + k; `end` is what the run
+  // finds past the last of them
+  m_path.clear();
+  int state = m_forward.start(from == 0);
+  int end = -1;
+  for (std::size_t i = from;; ++i)
+  {
+    int known = m_run_heads[i];
+    while (known >= 0 && m_run_ends[known].state != state)
+      known = m_run_ends[known].next;
+    if (known >= 0)
+    {
+      end = m_run_ends[known].end;
+      break;
+    }
+
+    m_path.push_back(state);
+    if (i == n)
+      break;
+    state = m_forward.next(state, static_cast<unsigned char>(line[i]));
+    if (state == RegexDfa::DEAD)
+      break;
+  }
+
+  // an accepting position only counts where nothing later does
+  for (std::size_t k = m_path.size(); k-- > 0;)
+  {
+    const auto pos = from + k;
+    if (end < 0 && m_forward.accepts(m_path[k], pos == n))
+      end = static_cast<int>(pos);
+
+    m_run_ends.push_back({m_path[k], end, m_run_heads[pos]});
+    m_run_heads[pos] = static_cast<int>(m_run_ends.size()) - 1;
+  }
+  return end;
+}
@@ -0,0 +1,149 @@
+#include "kilo++/RowArena.hpp"
+
+#include <algorithm>
+
+/*** counting resource ***/
+
+CountingResource::CountingResource(std::pmr::memory_resource *upstream)
+    : m_upstream(upstream)
+{
+}
+
+std::size_t CountingResource::bytes() const
+{
+  return m_bytes;
+}
+
+std::size_t CountingResource::allocations() const
+{
+  return m_allocations;
+}
+
+void CountingResource::reset()
+{
+  m_bytes = 0;
+  m_allocations = 0;
+}
+
+void *CountingResource::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+  void *p = m_upstream->allocate(bytes, alignment);
+  m_bytes += bytes;
+  m_allocations++;
+  return p;
+}
+
+void CountingResource::do_deallocate(void *p, std::size_t bytes, std::size_t alignment)
+{
+  m_upstream->deallocate(p, bytes, alignment);
+  m_bytes -= bytes;
+}
+
+bool CountingResource::do_is_equal(const std::pmr::memory_resource &other) const noexcept
+{
+  return this == &other;
+}
+
+/*** slab resource ***/
+
+SlabResource::SlabResource(std::size_t block_size, std::pmr::memory_resource *upstream)
+    : m_requested(block_size),
+      m_block((std::max(block_size, sizeof(void *)) + alignof(std::max_align_t) - 1) /
+              alignof(std::max_align_t) * alignof(std::max_align_t)),
+      m_upstream(upstream)
+{
+}
+
+SlabResource::~SlabResource()
+{
+  release();
+}
+
+void SlabResource::release()
+{
+  for (std::size_t i = 0; i < m_chunks.size(); ++i)
+    m_upstream->deallocate(m_chunks[i], m_block << (8 + std::min<std::size_t>(i, 4)), alignof(std::max_align_t));
+
+  m_chunks.clear();
+  m_free = nullptr;
+}
+
+void *SlabResource::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+  if (bytes != m_requested || alignment > alignof(std::max_align_t))
+    return m_upstream->allocate(bytes, alignment);
+
+  if (!m_free)
+  {
+    // chunks double from 256 blocks up to 4096 and stay there
+    const std::size_t blocks = std::size_t(256) << std::min<std::size_t>(m_chunks.size(), 4);
+    char *chunk = static_cast<char *>(m_upstream->allocate(m_block * blocks, alignof(std::max_align_t)));
+    m_chunks.push_back(chunk);
+
+    for (std::size_t i = blocks; i-- > 0;)
+    {
+      void *block = chunk + i * m_block;
+      *static_cast<void **>(block) = m_free;
+      m_free = block;
+    }
+  }
+
+  void *block = m_free;
+  m_free = *static_cast<void **>(block);
+  return block;
+}
+
+void SlabResource::do_deallocate(void *p, std::size_t bytes, std::size_t alignment)
+{
+  if (bytes != m_requested || alignment > alignof(std::max_align_t))
+  {
+    m_upstream->deallocate(p, bytes, alignment);
+    return;
+  }
+
+  *static_cast<void **>(p) = m_free;
+  m_free = p;
+}
+
+bool SlabResource::do_is_equal(const std::pmr::memory_resource &other) const noexcept
+{
+  return this == &other;
+}
+
+/*** row arena ***/
+
+RowArena::RowArena(std::size_t node_size)
+    : m_system(std::pmr::new_delete_resource()),
+      m_pool(&m_system),
+      m_slab(node_size, &m_system),
+      m_front(&m_pool),
+      m_node_front(&m_slab)
+{
+}
+
+std::pmr::memory_resource *RowArena::resource()
+{
+  return &m_front;
+}
+
+std::pmr::memory_resource *RowArena::nodeResource()
+{
+  return &m_node_front;
+}
+
+ArenaStats RowArena::stats() const
+{
+  ArenaStats stats;
+  stats.bytes_in_use = m_front.bytes() + m_node_front.bytes();
+  stats.bytes_reserved = m_system.bytes();
+  stats.allocations = m_front.allocations() + m_node_front.allocations();
+  return stats;
+}
+
+void RowArena::release()
+{
+  m_pool.release();
+  m_slab.release();
+  m_front.reset();
+  m_node_front.reset();
+}
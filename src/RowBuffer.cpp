@@ -0,0 +1,649 @@
+#include "kilo++/RowBuffer.hpp"
+#include "kilo++/ThreadPool.hpp"
+
+#include <algorithm>
+#include <new>
+#include <numeric>
+#include <utility>
+
+/*** defines ***/
+
+#define KILO_WRAP_GRAIN 4096
+
+/*** row buffer ***/
+
+// Nothing in the tree owns memory outside the arena, so dropping the arena
+// frees it all without visiting a single node.
+RowBuffer::~RowBuffer() = default;
+
+RowBuffer::RowBuffer(RowBuffer &&other) noexcept
+    : m_arena(std::move(other.m_arena)),
+      m_root(std::exchange(other.m_root, nullptr)),
+      m_seed(other.m_seed),
+      m_source(std::move(other.m_source)),
+      m_materializer(std::move(other.m_materializer)),
+      m_wrap_cols(other.m_wrap_cols),
+      m_width(std::move(other.m_width)),
+      m_source_visuals(std::move(other.m_source_visuals))
+{
+}
+
+RowBuffer &RowBuffer::operator=(RowBuffer &&other) noexcept
+{
+  if (this != &other)
+  {
+    m_arena = std::move(other.m_arena);
+    m_root = std::exchange(other.m_root, nullptr);
+    m_seed = other.m_seed;
+    m_source = std::move(other.m_source);
+    m_materializer = std::move(other.m_materializer);
+    m_wrap_cols = other.m_wrap_cols;
+    m_width = std::move(other.m_width);
+    m_source_visuals = std::move(other.m_source_visuals);
+  }
+  return *this;
+}
+
+void RowBuffer::assign(std::shared_ptr<const FileSource> source)
+{
+  clear();
+  m_source = std::move(source);
+
+  if (m_source && m_source->lineCount() > 0)
+  {
+    m_root = newNode(0, m_source->lineCount(), nextPriority());
+    update(m_root);
+  }
+}
+
+void RowBuffer::setMaterializer(Materializer materializer)
+{
+  m_materializer = std::move(materializer);
+}
+
+std::size_t RowBuffer::size() const
+{
+  return sizeOf(m_root);
+}
+
+bool RowBuffer::empty() const
+{
+  return m_root == nullptr;
+}
+
+bool RowBuffer::isMaterialized(std::size_t index) const
+{
+  return find(index)->materialized;
+}
+
+EditorRow &RowBuffer::operator[](std::size_t index)
+{
+  std::size_t offset = index;
+  auto *found = const_cast<Node *>(find(offset));
+  if (found->materialized)
+  {
+    if (found->evicted && m_materializer)
+      m_materializer(found->row);
+    found->evicted = false;
+    return found->row;
+  }
+
+  // cut the single line out of its run and turn it into a real row
+  Node *left, *mid, *right;
+  split(m_root, index, left, right);
+  split(right, 1, mid, right);
+
+  // mid is a lone node now, so it can take a fresh priority; keeping the
+  // run's one would line up every materialized row in a single chain
+  mid->priority = nextPriority();
+  mid->materialized = true;
+  mid->row.row.assign(m_source->line(mid->source_line));
+  if (m_materializer)
+    m_materializer(mid->row);
+
+  m_root = merge(merge(left, mid), right);
+  return mid->row;
+}
+
+void RowBuffer::materializeAll()
+{
+  for (std::size_t i = 0; i < size(); ++i)
+  {
+    if (!isMaterialized(i))
+      (*this)[i];
+  }
+}
+
+std::string_view RowBuffer::lineAt(std::size_t index) const
+{
+  const Node *node = find(index);
+  if (node->materialized)
+    return node->row.row;
+
+  return m_source->line(node->source_line + index);
+}
+
+void RowBuffer::insert(std::size_t index, EditorRow erow)
+{
+  Node *left, *right;
+  split(m_root, index, left, right);
+  Node *node = newNode(std::move(erow), nextPriority());
+  node->vlines = node->vsize = lineVisuals(node->row.row);
+  m_root = merge(merge(left, node), right);
+}
+
+void RowBuffer::erase(std::size_t index)
+{
+  Node *left, *mid, *right;
+  split(m_root, index, left, right);
+  split(right, 1, mid, right);
+  destroy(mid);
+  m_root = merge(left, right);
+}
+
+void RowBuffer::clear()
+{
+  m_root = nullptr;
+  if (m_arena)
+    m_arena->release();
+  m_source.reset();
+  m_wrap_cols = 0;
+  m_source_visuals.clear();
+}
+
+void RowBuffer::appendSourceLines(std::size_t old_lines)
+{
+  const auto lines = m_source->lineCount();
+
+  // a last line without a newline may have grown; a row already made from
+  // it takes the new text
+  if (old_lines && size() == old_lines && isMaterialized(old_lines - 1))
+  {
+    auto &erow = (*this)[old_lines - 1];
+    erow.row.assign(m_source->line(old_lines - 1));
+    if (m_materializer)
+      m_materializer(erow);
+    erow.hl_valid = false;
+  }
+  if (m_wrap_cols)
+  {
+    const auto from = old_lines ? old_lines - 1 : 0;
+    m_source_visuals.resize(lines + 1);
+    for (auto i = from; i < lines; ++i)
+      m_source_visuals[i + 1] = m_source_visuals[i] + lineVisuals(m_source->line(i));
+
+    if (!empty())
+      rewrap(size() - 1);
+  }
+
+  if (lines > old_lines)
+  {
+    Node *run = newNode(old_lines, lines - old_lines, nextPriority());
+    run->vlines = run->vsize = runVisuals(old_lines, lines - old_lines);
+    m_root = merge(m_root, run);
+  }
+}
+
+void RowBuffer::forEachLine(const std::function<void(std::string_view)> &fn) const
+{
+  visitLines(m_root, fn);
+}
+
+void RowBuffer::forEachLine(std::size_t first, std::size_t last,
+                            const std::function<void(std::size_t, std::string_view)> &fn) const
+{
+  if (first < last)
+    visitRange(m_root, 0, first, last, fn);
+}
+
+void RowBuffer::forEachMaterialized(const std::function<void(EditorRow &)> &fn)
+{
+  visitMaterialized(m_root, fn);
+}
+
+ArenaStats RowBuffer::memoryStats() const
+{
+  return m_arena ? m_arena->stats() : ArenaStats();
+}
+
+RowMemory RowBuffer::memoryUsage() const
+{
+  RowMemory memory;
+  tallyMemory(m_root, memory);
+  memory.index = indexBytes();
+  return memory;
+}
+
+std::size_t RowBuffer::indexBytes() const
+{
+  return (m_source ? m_source->indexBytes() : 0) + m_source_visuals.capacity() * sizeof(std::size_t);
+}
+
+std::size_t RowBuffer::evictDerived(std::size_t keep_first, std::size_t keep_last)
+{
+  return evictDerived(m_root, 0, keep_first, keep_last);
+}
+
+void RowBuffer::compact()
+{
+  if (!m_arena)
+    return;
+
+  // arena() makes the new one on the first node copied; the old one goes
+  // with everything in it once the copy is done
+  const auto old = std::move(m_arena);
+  m_root = copyTree(m_root);
+}
+
+/*** wrapping ***/
+
+void RowBuffer::setWrap(int cols, WidthFn width)
+{
+  m_wrap_cols = std::max(cols, 0);
+  m_width = std::move(width);
+  m_source_visuals.clear();
+
+  if (m_wrap_cols && m_source)
+  {
+    // each entry is filled by one chunk, then summed up in order
+    const auto lines = m_source->lineCount();
+    m_source_visuals.assign(lines + 1, 0);
+    ThreadPool::shared().parallelFor(lines, KILO_WRAP_GRAIN, [this](std::size_t begin, std::size_t end)
+                                     {
+                                       for (auto i = begin; i < end; ++i)
+                                         m_source_visuals[i + 1] = lineVisuals(m_source->line(i));
+                                     });
+    std::partial_sum(m_source_visuals.begin(), m_source_visuals.end(), m_source_visuals.begin());
+  }
+
+  rewrapAll(m_root);
+}
+
+int RowBuffer::wrapColumns() const
+{
+  return m_wrap_cols;
+}
+
+void RowBuffer::rewrap(std::size_t index)
+{
+  if (m_wrap_cols)
+    rewrap(m_root, index);
+}
+
+std::size_t RowBuffer::visualLines() const
+{
+  return vsizeOf(m_root);
+}
+
+std::size_t RowBuffer::visualLinesAt(std::size_t index) const
+{
+  const Node *node = find(index);
+  return node->materialized ? node->vlines : runVisuals(node->source_line + index, 1);
+}
+
+std::size_t RowBuffer::visualLineOf(std::size_t index) const
+{
+  std::size_t vline = 0;
+  const Node *node = m_root;
+  while (node)
+  {
+    const auto lsize = sizeOf(node->left);
+    if (index < lsize)
+    {
+      node = node->left;
+      continue;
+    }
+
+    vline += vsizeOf(node->left);
+    index -= lsize;
+    if (index < node->count)
+      return vline + (node->materialized ? 0 : runVisuals(node->source_line, index));
+
+    vline += node->vlines;
+    index -= node->count;
+    node = node->right;
+  }
+  return vline;
+}
+
+std::size_t RowBuffer::rowAtVisualLine(std::size_t vline, std::size_t &offset) const
+{
+  if (vline >= visualLines())
+  {
+    offset = vline - visualLines();
+    return size();
+  }
+
+  std::size_t base = 0;
+  const Node *node = m_root;
+  while (true)
+  {
+    const auto lvsize = vsizeOf(node->left);
+    if (vline < lvsize)
+    {
+      node = node->left;
+      continue;
+    }
+
+    vline -= lvsize;
+    base += sizeOf(node->left);
+    if (vline < node->vlines)
+      break;
+
+    vline -= node->vlines;
+    base += node->count;
+    node = node->right;
+  }
+
+  if (node->materialized)
+  {
+    offset = vline;
+    return base;
+  }
+  if (!m_wrap_cols)
+  {
+    offset = 0;
+    return base + vline;
+  }
+
+  // the last line of the run starting at or before the screen line
+  const auto first = m_source_visuals.begin() + node->source_line;
+  const auto target = *first + vline;
+  const auto line = std::upper_bound(first, first + node->count + 1, target) - 1;
+  offset = target - *line;
+  return base + (line - first);
+}
+
+std::size_t RowBuffer::lineVisuals(std::string_view line) const
+{
+  return m_wrap_cols ? m_width(line) / m_wrap_cols + 1 : 1;
+}
+
+std::size_t RowBuffer::runVisuals(std::size_t first_line, std::size_t lines) const
+{
+  if (!m_wrap_cols)
+    return lines;
+  return m_source_visuals[first_line + lines] - m_source_visuals[first_line];
+}
+
+// Walks down to row `index`, recounting it and every subtree on the way.
+void RowBuffer::rewrap(Node *node, std::size_t index)
+{
+  const auto lsize = sizeOf(node->left);
+  if (index < lsize)
+    rewrap(node->left, index);
+  else if (index >= lsize + node->count)
+    rewrap(node->right, index - lsize - node->count);
+  else
+    node->vlines = node->materialized ? lineVisuals(node->row.row) : runVisuals(node->source_line, node->count);
+  update(node);
+}
+
+void RowBuffer::rewrapAll(Node *node)
+{
+  if (!node)
+    return;
+
+  rewrapAll(node->left);
+  rewrapAll(node->right);
+  node->vlines = node->materialized ? lineVisuals(node->row.row) : runVisuals(node->source_line, node->count);
+  update(node);
+}
+
+/*** treap operations ***/
+
+std::size_t RowBuffer::sizeOf(const Node *node)
+{
+  return node ? node->size : 0;
+}
+
+std::size_t RowBuffer::vsizeOf(const Node *node)
+{
+  return node ? node->vsize : 0;
+}
+
+void RowBuffer::update(Node *node)
+{
+  node->size = node->count + sizeOf(node->left) + sizeOf(node->right);
+  node->vsize = node->vlines + vsizeOf(node->left) + vsizeOf(node->right);
+}
+
+// Splits the subtree so that `left` receives its first `count` lines and
+// `right` the remaining ones, cutting a run in two if necessary.
+void RowBuffer::split(Node *node, std::size_t count, Node *&left, Node *&right)
+{
+  if (!node)
+  {
+    left = right = nullptr;
+    return;
+  }
+
+  const auto lsize = sizeOf(node->left);
+  if (count <= lsize)
+  {
+    split(node->left, count, left, node->left);
+    right = node;
+  }
+  else if (count >= lsize + node->count)
+  {
+    split(node->right, count - lsize - node->count, node->right, right);
+    left = node;
+  }
+  else
+  {
+    // the tail ends up where the node was, under the same ancestors, so it
+    // may not outrank it; a fresh draw below the node's keeps the pieces of
+    // one run from all tying and lining up in a chain
+    const auto cut = count - lsize;
+    Node *tail = newNode(node->source_line + cut, node->count - cut, std::min(nextPriority(), node->priority));
+    tail->vlines = tail->vsize = runVisuals(tail->source_line, tail->count);
+    Node *rest = node->right;
+
+    node->count = cut;
+    node->vlines = runVisuals(node->source_line, cut);
+    node->right = nullptr;
+    left = node;
+    right = merge(tail, rest);
+  }
+  update(node);
+}
+
+RowBuffer::Node *RowBuffer::merge(Node *left, Node *right)
+{
+  if (!left || !right)
+    return left ? left : right;
+
+  if (left->priority > right->priority)
+  {
+    left->right = merge(left->right, right);
+    update(left);
+    return left;
+  }
+
+  right->left = merge(left, right->left);
+  update(right);
+  return right;
+}
+
+template <typename... Args>
+RowBuffer::Node *RowBuffer::newNode(Args &&...args)
+{
+  auto &nodes = arena();
+  std::pmr::polymorphic_allocator<Node> alloc(nodes.nodeResource());
+  return new (alloc.allocate(1)) Node(std::forward<Args>(args)..., EditorRow::allocator_type(nodes.resource()));
+}
+
+void RowBuffer::destroy(Node *node)
+{
+  if (!node)
+    return;
+
+  destroy(node->left);
+  destroy(node->right);
+
+  std::pmr::polymorphic_allocator<Node> alloc(arena().nodeResource());
+  node->~Node();
+  alloc.deallocate(node, 1);
+}
+
+// A moved-from buffer has no arena until it is used again.
+RowArena &RowBuffer::arena()
+{
+  if (!m_arena)
+    m_arena = std::make_unique<RowArena>(sizeof(Node));
+  return *m_arena;
+}
+
+// Returns the node holding line `index` and rewrites `index` to the
+// offset of that line inside the node.
+const RowBuffer::Node *RowBuffer::find(std::size_t &index) const
+{
+  const Node *node = m_root;
+  while (true)
+  {
+    const auto lsize = sizeOf(node->left);
+    if (index < lsize)
+    {
+      node = node->left;
+    }
+    else if (index < lsize + node->count)
+    {
+      index -= lsize;
+      return node;
+    }
+    else
+    {
+      index -= lsize + node->count;
+      node = node->right;
+    }
+  }
+}
+
+void RowBuffer::visitLines(const Node *node, const std::function<void(std::string_view)> &fn) const
+{
+  for (; node; node = node->right)
+  {
+    visitLines(node->left, fn);
+
+    if (node->materialized)
+    {
+      fn(node->row.row);
+    }
+    else
+    {
+      for (std::size_t i = 0; i < node->count; ++i)
+        fn(m_source->line(node->source_line + i));
+    }
+  }
+}
+
+// `base` is the index of the first line in the subtree; subtrees outside
+// [first, last) are skipped without being entered.
+void RowBuffer::visitRange(const Node *node, std::size_t base, std::size_t first, std::size_t last,
+                           const std::function<void(std::size_t, std::string_view)> &fn) const
+{
+  while (node && base < last && base + node->size > first)
+  {
+    const auto lsize = sizeOf(node->left);
+    visitRange(node->left, base, first, last, fn);
+
+    const auto begin = base + lsize;
+    const auto end = begin + node->count;
+    for (auto i = std::max(begin, first); i < std::min(end, last); ++i)
+    {
+      if (node->materialized)
+        fn(i, node->row.row);
+      else
+        fn(i, m_source->line(node->source_line + (i - begin)));
+    }
+
+    base = end;
+    node = node->right;
+  }
+}
+
+void RowBuffer::visitMaterialized(Node *node, const std::function<void(EditorRow &)> &fn)
+{
+  for (; node; node = node->right)
+  {
+    visitMaterialized(node->left, fn);
+
+    if (node->materialized)
+      fn(node->row);
+  }
+}
+
+void RowBuffer::tallyMemory(const Node *node, RowMemory &memory)
+{
+  // what fits in the string itself never reaches the arena
+  static const std::size_t inline_capacity = std::pmr::string().capacity();
+
+  for (; node; node = node->right)
+  {
+    tallyMemory(node->left, memory);
+
+    memory.nodes += sizeof(Node);
+    if (!node->materialized)
+      continue;
+
+    const auto &erow = node->row;
+    if (erow.row.capacity() > inline_capacity)
+      memory.text += erow.row.capacity() + 1;
+    memory.tabs += erow.tabs.capacity() * sizeof(uint32_t);
+    memory.hl += erow.hl.capacity() * sizeof(HighlightSpan);
+  }
+}
+
+// `base` is the index of the first line in the subtree, as in visitRange().
+std::size_t RowBuffer::evictDerived(Node *node, std::size_t base, std::size_t keep_first,
+                                    std::size_t keep_last)
+{
+  std::size_t freed = 0;
+  for (; node; node = node->right)
+  {
+    freed += evictDerived(node->left, base, keep_first, keep_last);
+    base += sizeOf(node->left);
+
+    auto &erow = node->row;
+    if (node->materialized && (erow.hl.capacity() || erow.tabs.capacity()) &&
+        (base < keep_first || base > keep_last))
+    {
+      freed += erow.hl.capacity() * sizeof(HighlightSpan) + erow.tabs.capacity() * sizeof(uint32_t);
+      erow.hl = std::pmr::vector<HighlightSpan>(erow.hl.get_allocator());
+      erow.tabs = std::pmr::vector<uint32_t>(erow.tabs.get_allocator());
+      erow.hl_valid = false;
+      node->evicted = true;
+    }
+    base += node->count;
+  }
+  return freed;
+}
+
+RowBuffer::Node *RowBuffer::copyTree(Node *node)
+{
+  if (!node)
+    return nullptr;
+
+  Node *copy = node->materialized
+                   ? newNode(std::move(node->row), node->priority)
+                   : newNode(node->source_line, node->count, node->priority);
+  copy->materialized = node->materialized;
+  copy->evicted = node->evicted;
+  copy->source_line = node->source_line;
+  copy->count = node->count;
+  copy->size = node->size;
+  copy->vlines = node->vlines;
+  copy->vsize = node->vsize;
+  copy->left = copyTree(node->left);
+  copy->right = copyTree(node->right);
+  return copy;
+}
+
+uint32_t RowBuffer::nextPriority()
+{
+  // xorshift32 keeps the tree balanced in expectation without pulling in <random>
+  m_seed ^= m_seed << 13;
+  m_seed ^= m_seed >> 17;
+  m_seed ^= m_seed << 5;
+  return m_seed;
+}
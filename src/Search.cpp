@@ -0,0 +1,261 @@
+#include "kilo++/Search.hpp"
+#include "kilo++/Regex.hpp"
+#include "kilo++/ThreadPool.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KILO_SEARCH_X86 1
+#endif
+
+// lines per chunk below which a scan is not worth splitting
+#define KILO_SEARCH_GRAIN 8192
+
+/*** substring search ***/
+
+namespace
+{
+  // Fallback for the bytes the vector loops cannot cover.
+  std::size_t findScalar(const char *h, std::size_t n, const char *needle, std::size_t k, std::size_t from)
+  {
+    while (from + k <= n)
+    {
+      const void *p = std::memchr(h + from, needle[0], n - k + 1 - from);
+      if (!p)
+        return std::string_view::npos;
+
+      from = static_cast<const char *>(p) - h;
+      if (std::memcmp(h + from + 1, needle + 1, k - 1) == 0)
+        return from;
+      from++;
+    }
+    return std::string_view::npos;
+  }
+
+#ifdef KILO_SEARCH_X86
+  std::size_t findSSE2(const char *h, std::size_t n, const char *needle, std::size_t k, std::size_t from)
+  {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[k - 1]);
+
+    std::size_t i = from;
+    for (; i + k - 1 + 16 <= n; i += 16)
+    {
+      const __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h + i));
+      const __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h + i + k - 1));
+      unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+          _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last))));
+
+      while (mask)
+      {
+        const unsigned bit = __builtin_ctz(mask);
+        if (k <= 2 || std::memcmp(h + i + bit + 1, needle + 1, k - 2) == 0)
+          return i + bit;
+        mask &= mask - 1;
+      }
+    }
+    return findScalar(h, n, needle, k, i);
+  }
+
+  __attribute__((target("avx2"))) std::size_t findAVX2(const char *h, std::size_t n, const char *needle,
+                                                        std::size_t k, std::size_t from)
+  {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[k - 1]);
+
+    std::size_t i = from;
+    for (; i + k - 1 + 32 <= n; i += 32)
+    {
+      const __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(h + i));
+      const __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(h + i + k - 1));
+      unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+          _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last))));
+
+      while (mask)
+      {
+        const unsigned bit = __builtin_ctz(mask);
+        if (k <= 2 || std::memcmp(h + i + bit + 1, needle + 1, k - 2) == 0)
+          return i + bit;
+        mask &= mask - 1;
+      }
+    }
+    return findSSE2(h, n, needle, k, i);
+  }
+
+  const bool has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+std::size_t findSubstring(std::string_view haystack, std::string_view needle, std::size_t from)
+{
+  const std::size_t n = haystack.size(), k = needle.size();
+  if (k == 0)
+    return from <= n ? from : std::string_view::npos;
+  if (from >= n || k > n - from)
+    return std::string_view::npos;
+
+#ifdef KILO_SEARCH_X86
+  if (has_avx2)
+    return findAVX2(haystack.data(), n, needle.data(), k, from);
+  return findSSE2(haystack.data(), n, needle.data(), k, from);
+#else
+  return findScalar(haystack.data(), n, needle.data(), k, from);
+#endif
+}
+
+/*** match index ***/
+
+namespace
+{
+  // Runs a line matcher over chunks of lines on the shared thread pool.
+  // Every chunk gets its own matcher from `make_matcher`, so matchers may
+  // keep per-thread state, and collects its own matches; sorting the chunks
+  // by their first line afterwards keeps the result in buffer order.
+  template <typename MakeMatcher>
+  void scanChunks(const RowBuffer &rows, MakeMatcher make_matcher, std::vector<SearchMatch> &matches)
+  {
+    std::mutex mutex;
+    std::vector<std::pair<std::size_t, std::vector<SearchMatch>>> chunks;
+
+    ThreadPool::shared().parallelFor(
+        rows.size(), KILO_SEARCH_GRAIN, [&](std::size_t begin, std::size_t end)
+        {
+          auto match_line = make_matcher();
+          std::vector<SearchMatch> found;
+          rows.forEachLine(begin, end, [&](std::size_t row, std::string_view line)
+                           { match_line(static_cast<int>(row), line, found); });
+
+          std::lock_guard<std::mutex> lock(mutex);
+          chunks.emplace_back(begin, std::move(found));
+        });
+
+    std::sort(chunks.begin(), chunks.end(), [](const auto &a, const auto &b)
+              { return a.first < b.first; });
+
+    std::size_t total = 0;
+    for (const auto &chunk : chunks)
+      total += chunk.second.size();
+
+    matches.reserve(total);
+    for (const auto &chunk : chunks)
+      matches.insert(matches.end(), chunk.second.begin(), chunk.second.end());
+  }
+}
+
+const std::vector<SearchMatch> &SearchIndex::update(const RowBuffer &rows, uint64_t version,
+                                                    const std::string &query, SearchMode mode)
+{
+  if (version != m_version || mode != m_mode || query.empty())
+  {
+    m_levels.clear();
+    m_version = version;
+    m_mode = mode;
+  }
+  m_error.clear();
+
+  if (query.empty())
+    return m_no_matches;
+
+  if (mode == SearchMode::REGEX)
+  {
+    // a longer pattern can match more than a shorter one, so only the
+    // latest result is worth keeping
+    if (!m_levels.empty() && m_levels.back().query == query)
+      return m_levels.back().matches;
+    m_levels.clear();
+
+    Level level;
+    level.query = query;
+    scanRegex(rows, query, level.matches, m_error);
+    if (!m_error.empty())
+      return m_no_matches;
+
+    m_levels.push_back(std::move(level));
+    return m_levels.back().matches;
+  }
+
+  // drop results for queries that are not a prefix of the new one
+  while (!m_levels.empty() && query.compare(0, m_levels.back().query.size(), m_levels.back().query) != 0)
+    m_levels.pop_back();
+
+  if (!m_levels.empty() && m_levels.back().query == query)
+    return m_levels.back().matches;
+
+  Level level;
+  level.query = query;
+  if (m_levels.empty())
+    scan(rows, query, level.matches);
+  else
+    refine(rows, query, m_levels.back().matches, level.matches);
+
+  m_levels.push_back(std::move(level));
+  return m_levels.back().matches;
+}
+
+const std::string &SearchIndex::error() const
+{
+  return m_error;
+}
+
+void SearchIndex::clear()
+{
+  m_levels.clear();
+  m_error.clear();
+}
+
+void SearchIndex::scan(const RowBuffer &rows, const std::string &query,
+                       std::vector<SearchMatch> &matches)
+{
+  const int len = static_cast<int>(query.size());
+  scanChunks(
+      rows, [&]
+      { return [&](int row, std::string_view line, std::vector<SearchMatch> &found)
+        {
+          for (auto pos = findSubstring(line, query);
+               pos != std::string_view::npos;
+               pos = findSubstring(line, query, pos + 1))
+            found.push_back({row, static_cast<int>(pos), len});
+        }; },
+      matches);
+}
+
+void SearchIndex::scanRegex(const RowBuffer &rows, const std::string &pattern,
+                            std::vector<SearchMatch> &matches, std::string &error)
+{
+  const auto regex = Regex::compile(pattern, error);
+  if (!regex)
+    return;
+
+  scanChunks(
+      rows, [&]
+      { return [matcher = RegexMatcher(*regex)](int row, std::string_view line,
+                                                std::vector<SearchMatch> &found) mutable
+        { matcher.forEachMatch(line, [&](std::size_t start, std::size_t len)
+                               { found.push_back({row, static_cast<int>(start), static_cast<int>(len)}); }); }; },
+      matches);
+}
+
+// Every match of a query starts at a match of any of its prefixes, so only
+// those positions need to be checked.
+void SearchIndex::refine(const RowBuffer &rows, const std::string &query,
+                         const std::vector<SearchMatch> &candidates,
+                         std::vector<SearchMatch> &matches)
+{
+  int cached_row = -1;
+  std::string_view line;
+  for (const auto &candidate : candidates)
+  {
+    if (candidate.row != cached_row)
+    {
+      line = rows.lineAt(candidate.row);
+      cached_row = candidate.row;
+    }
+
+    if (line.compare(candidate.col, query.size(), query) == 0)
+      matches.push_back({candidate.row, candidate.col, static_cast<int>(query.size())});
+  }
+}
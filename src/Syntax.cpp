@@ -0,0 +1,458 @@
+#include "kilo++/Syntax.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <memory>
+#include <string>
+
+/*** filetypes ***/
+
+const std::vector<std::string> C_HL_EXTENSIONS = {".c", ".h", ".cpp", ".hpp"};
+const std::vector<std::string> C_HL_KEYWORDS = {
+    "switch", "if", "while", "for", "break", "continue", "return", "else", "struct", "union", "typedef", "static", "const",
+    "enum", "class", "case", "int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|", "auto|", "void|"};
+
+const EditorSyntax HLDB[] = {
+    {"c",
+     C_HL_EXTENSIONS,
+     C_HL_KEYWORDS,
+     "//", "/*", "*/",
+     HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS},
+};
+
+/*** keyword table ***/
+
+namespace
+{
+  template <typename T>
+  void put(std::string &out, T value)
+  {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+
+  template <typename T>
+  bool get(std::string_view &in, T &value)
+  {
+    if (in.size() < sizeof(value))
+      return false;
+    std::memcpy(&value, in.data(), sizeof(value));
+    in.remove_prefix(sizeof(value));
+    return true;
+  }
+}
+
+KeywordTable::KeywordTable(const std::vector<std::string> &keywords)
+{
+  std::vector<std::pair<std::string_view, EditorHighlight>> entries;
+  for (std::string_view kw : keywords)
+  {
+    if (kw.empty())
+      continue;
+
+    auto hl = EditorHighlight::KEYWORD1;
+    if (kw.back() == '|')
+    {
+      kw.remove_suffix(1);
+      hl = EditorHighlight::KEYWORD2;
+    }
+    if (!kw.empty())
+      entries.emplace_back(kw, hl);
+  }
+
+  if (entries.empty())
+    return;
+
+  // Grow the table and retry seeds until no two keywords share a slot; with
+  // a load factor of at most 1/4 a collision-free seed is found quickly.
+  std::size_t table_size = 1;
+  while (table_size < entries.size() * 4)
+    table_size <<= 1;
+
+  for (;; table_size <<= 1)
+  {
+    for (uint32_t seed = 1; seed <= 64; ++seed)
+    {
+      if (build(entries, table_size, seed))
+        return;
+    }
+  }
+}
+
+EditorHighlight KeywordTable::lookup(std::string_view token) const
+{
+  if (token.size() < m_min_len || token.size() > m_max_len)
+    return EditorHighlight::NORMAL;
+
+  const auto &slot = m_slots[hash(token, m_seed) & m_mask];
+  if (slot.length != token.size() ||
+      std::memcmp(m_words.data() + slot.offset, token.data(), token.size()) != 0)
+    return EditorHighlight::NORMAL;
+
+  return slot.hl;
+}
+
+bool KeywordTable::empty() const
+{
+  return m_slots.empty();
+}
+
+void KeywordTable::save(std::string &out) const
+{
+  put(out, static_cast<uint32_t>(m_words.size()));
+  out += m_words;
+  put(out, static_cast<uint32_t>(m_slots.size()));
+  for (const auto &slot : m_slots)
+  {
+    put(out, slot.offset);
+    put(out, slot.length);
+    put(out, static_cast<uint8_t>(slot.hl));
+  }
+  put(out, m_mask);
+  put(out, m_seed);
+  put(out, static_cast<uint32_t>(m_min_len));
+  put(out, static_cast<uint32_t>(m_max_len));
+}
+
+bool KeywordTable::load(std::string_view &in)
+{
+  uint32_t words_size, slot_count;
+  if (!get(in, words_size) || in.size() < words_size)
+    return false;
+  std::string words(in.substr(0, words_size));
+  in.remove_prefix(words_size);
+
+  if (!get(in, slot_count))
+    return false;
+  std::vector<Slot> slots(slot_count);
+  for (auto &slot : slots)
+  {
+    uint8_t hl;
+    if (!get(in, slot.offset) || !get(in, slot.length) || !get(in, hl) ||
+        hl >= HL_COUNT || slot.offset > words.size() || slot.length > words.size() - slot.offset)
+      return false;
+    slot.hl = static_cast<EditorHighlight>(hl);
+  }
+
+  uint32_t mask, seed, min_len, max_len;
+  if (!get(in, mask) || !get(in, seed) || !get(in, min_len) || !get(in, max_len))
+    return false;
+  // lookup() indexes the slots with the mask, so they must agree
+  if (slot_count ? (slot_count & (slot_count - 1)) != 0 || mask != slot_count - 1 : mask != 0)
+    return false;
+
+  m_words = std::move(words);
+  m_slots = std::move(slots);
+  m_mask = mask;
+  m_seed = seed;
+  m_min_len = min_len;
+  m_max_len = max_len;
+  return true;
+}
+
+uint32_t KeywordTable::hash(std::string_view token, uint32_t seed)
+{
+  // FNV-1a, seeded so the constructor can search for a collision-free variant
+  uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+  for (unsigned char c : token)
+  {
+    h ^= c;
+    h *= 16777619u;
+  }
+  return h ^ (h >> 15);
+}
+
+bool KeywordTable::build(const std::vector<std::pair<std::string_view, EditorHighlight>> &entries,
+                         std::size_t table_size, uint32_t seed)
+{
+  std::vector<Slot> slots(table_size);
+  std::string words;
+  std::size_t min_len = SIZE_MAX, max_len = 0;
+  const uint32_t mask = static_cast<uint32_t>(table_size - 1);
+
+  for (const auto &[kw, hl] : entries)
+  {
+    auto &slot = slots[hash(kw, seed) & mask];
+    if (slot.length)
+    {
+      // a duplicate keyword keeps its first category
+      if (std::string_view(words.data() + slot.offset, slot.length) == kw)
+        continue;
+      return false;
+    }
+
+    slot.offset = static_cast<uint32_t>(words.size());
+    slot.length = static_cast<uint32_t>(kw.size());
+    slot.hl = hl;
+    words += kw;
+    min_len = std::min(min_len, kw.size());
+    max_len = std::max(max_len, kw.size());
+  }
+
+  m_words = std::move(words);
+  m_slots = std::move(slots);
+  m_mask = mask;
+  m_seed = seed;
+  m_min_len = min_len;
+  m_max_len = max_len;
+  return true;
+}
+
+/*** syntax highlighting ***/
+
+namespace
+{
+  struct SeparatorTable
+  {
+    SeparatorTable()
+    {
+      for (int c = 0; c < 256; ++c)
+        table[c] = std::isspace(c) || c == '\0' || std::strchr(",.()+-/*=~%<>[];", c) != NULL;
+    }
+
+    bool table[256];
+  };
+
+  const SeparatorTable separators;
+
+  inline bool isSeparatorByte(char c)
+  {
+    return separators.table[static_cast<unsigned char>(c)];
+  }
+}
+
+bool isSeparator(int c)
+{
+  return isSeparatorByte(static_cast<char>(c));
+}
+
+namespace
+{
+  // definitions loaded at startup, newest first
+  std::vector<std::shared_ptr<const EditorSyntax>> registered;
+
+  bool matches(const EditorSyntax &syntax, const std::string &filename)
+  {
+    const auto ext = filename.rfind('.');
+    for (const auto &fm : syntax.filematch)
+    {
+      const bool is_ext = fm[0] == '.';
+      if ((is_ext && ext != std::string::npos && !filename.compare(ext, std::string::npos, fm)) ||
+          (!is_ext && filename.find(fm) != std::string::npos))
+        return true;
+    }
+    return false;
+  }
+}
+
+void registerSyntax(std::shared_ptr<const EditorSyntax> syntax)
+{
+  registered.insert(registered.begin(), std::move(syntax));
+}
+
+// Each built-in definition is compiled the first time any buffer needs it
+// and is shared read-only from then on.
+std::shared_ptr<const EditorSyntax> findSyntax(const std::string &filename)
+{
+  for (const auto &syntax : registered)
+  {
+    if (matches(*syntax, filename))
+      return syntax;
+  }
+
+  static const auto compiled = []
+  {
+    std::vector<std::shared_ptr<const EditorSyntax>> syntaxes;
+    for (const auto &entry : HLDB)
+    {
+      auto syntax = std::make_shared<EditorSyntax>(entry);
+      compileSyntax(*syntax);
+      syntaxes.push_back(std::move(syntax));
+    }
+    return syntaxes;
+  }();
+
+  for (const auto &syntax : compiled)
+  {
+    if (matches(*syntax, filename))
+      return syntax;
+  }
+
+  return nullptr;
+}
+
+void compileSyntax(EditorSyntax &syntax)
+{
+  syntax.keyword_table = KeywordTable(syntax.keywords);
+}
+
+// Colours [start, start + len). The highlighter only ever paints at or
+// after the end of the previous span, so touching runs of one class merge.
+static void paint(std::pmr::vector<HighlightSpan> &hl, std::size_t start, std::size_t len, EditorHighlight cls)
+{
+  if (!hl.empty())
+  {
+    auto &last = hl.back();
+    const std::size_t last_end = last.start + last.len;
+    if (last.hl == cls && start <= last_end)
+    {
+      last.len = static_cast<uint32_t>(std::max(last_end, start + len) - last.start);
+      return;
+    }
+  }
+  hl.push_back({static_cast<uint32_t>(start), static_cast<uint32_t>(len), cls});
+}
+
+static bool isSLCommentStarted(std::string_view text, std::pmr::vector<HighlightSpan> &hl,
+                               const std::string &comment_start_kw, std::size_t pos)
+{
+  if (!text.compare(pos, comment_start_kw.size(), comment_start_kw))
+  {
+    paint(hl, pos, text.size() - pos, EditorHighlight::COMMENT);
+    return true;
+  }
+  return false;
+}
+
+static bool isMLCommentStarted(std::string_view text, std::pmr::vector<HighlightSpan> &hl,
+                               const std::string &comment_start_kw, std::size_t pos)
+{
+  if (!text.compare(pos, comment_start_kw.size(), comment_start_kw))
+  {
+    paint(hl, pos, comment_start_kw.size(), EditorHighlight::ML_COMMENT);
+    return true;
+  }
+  return false;
+}
+
+static bool isMLCommentEnded(std::string_view text, std::pmr::vector<HighlightSpan> &hl,
+                             const std::string &comment_end_kw, std::size_t pos)
+{
+  if (!text.compare(pos, comment_end_kw.size(), comment_end_kw))
+  {
+    paint(hl, pos, comment_end_kw.size(), EditorHighlight::ML_COMMENT);
+    return true;
+  }
+  return false;
+}
+
+bool highlightRow(const EditorSyntax &syntax, std::string_view text, bool in_comment,
+                  std::pmr::vector<HighlightSpan> &hl)
+{
+  hl.clear();
+
+  const auto &keywords = syntax.keyword_table;
+  const auto &scs = syntax.singleline_comment_start;
+  const auto &mcs = syntax.multiline_comment_start;
+  const auto &mce = syntax.multiline_comment_end;
+
+  bool prev_sep = true;
+  int in_string = 0;
+
+  std::size_t i = 0;
+  while (i < text.size())
+  {
+    const auto c = text[i];
+    const EditorHighlight prev_hl = !hl.empty() && hl.back().start + hl.back().len == i
+                                        ? hl.back().hl
+                                        : EditorHighlight::NORMAL;
+
+    if (!scs.empty() && !in_string && !in_comment)
+    {
+      if (isSLCommentStarted(text, hl, scs, i))
+        break;
+    }
+
+    if (!mcs.empty() && !mce.empty() && !in_string)
+    {
+      if (in_comment)
+      {
+        paint(hl, i, 1, EditorHighlight::ML_COMMENT);
+        if (isMLCommentEnded(text, hl, mce, i))
+        {
+          i += mce.size();
+          in_comment = false;
+          prev_sep = true;
+        }
+        else
+        {
+          i++;
+        }
+        continue;
+      }
+      else if (isMLCommentStarted(text, hl, mcs, i))
+      {
+        i += mcs.size();
+        in_comment = true;
+        continue;
+      }
+    }
+
+    if (syntax.flags & HL_HIGHLIGHT_STRINGS)
+    {
+      if (in_string)
+      {
+        paint(hl, i, 1, EditorHighlight::STRING);
+
+        if (c == '\\' && i + 1 < text.size())
+        {
+          paint(hl, i + 1, 1, EditorHighlight::STRING);
+          i += 2;
+          continue;
+        }
+
+        if (c == in_string)
+          in_string = 0;
+
+        prev_sep = true;
+        i++;
+        continue;
+      }
+      else
+      {
+        if (c == '"' || c == '\'')
+        {
+          in_string = c;
+          paint(hl, i, 1, EditorHighlight::STRING);
+          i++;
+          continue;
+        }
+      }
+    }
+
+    if (syntax.flags & HL_HIGHLIGHT_NUMBERS)
+    {
+      if ((std::isdigit(c) && (prev_sep || prev_hl == EditorHighlight::NUMBER)) ||
+          (c == '.' && prev_hl == EditorHighlight::NUMBER))
+      {
+        paint(hl, i, 1, EditorHighlight::NUMBER);
+        prev_sep = false;
+        i++;
+        continue;
+      }
+    }
+
+    if (prev_sep && !keywords.empty())
+    {
+      // keywords contain no separators, so a keyword matches exactly when it
+      // equals the whole token starting here
+      std::size_t end = i;
+      while (end < text.size() && !isSeparatorByte(text[end]))
+        end++;
+
+      const auto kw_hl = keywords.lookup(text.substr(i, end - i));
+      if (kw_hl != EditorHighlight::NORMAL)
+      {
+        paint(hl, i, end - i, kw_hl);
+        i = end;
+        prev_sep = false;
+        continue;
+      }
+    }
+
+    prev_sep = isSeparatorByte(c);
+    i++;
+  }
+
+  return in_comment;
+}
@@ -0,0 +1,377 @@
+#include "kilo++/SyntaxFile.hpp"
+#include "kilo++/AtomicFile.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <sys/stat.h>
+
+#ifndef KILO_SYNTAX_DIR
+#define KILO_SYNTAX_DIR "/usr/local/share/kilo++/syntax"
+#endif
+
+// The cache starts with the list of definition files it was built from,
+// each with its modification time and size, followed by every definition
+// in compiled form, keyword table included.
+namespace
+{
+  constexpr char MAGIC[8] = {'K', 'I', 'L', 'O', 'S', 'Y', 'N', '1'};
+
+  struct Source
+  {
+    std::string path;
+    int64_t mtime_ns;
+    uint64_t size;
+
+    bool operator==(const Source &other) const
+    {
+      return path == other.path && mtime_ns == other.mtime_ns && size == other.size;
+    }
+  };
+
+  template <typename T>
+  void put(std::string &out, T value)
+  {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+
+  void putString(std::string &out, std::string_view s)
+  {
+    put(out, static_cast<uint32_t>(s.size()));
+    out += s;
+  }
+
+  void putStrings(std::string &out, const std::vector<std::string> &strings)
+  {
+    put(out, static_cast<uint32_t>(strings.size()));
+    for (const auto &s : strings)
+      putString(out, s);
+  }
+
+  template <typename T>
+  bool get(std::string_view &in, T &value)
+  {
+    if (in.size() < sizeof(value))
+      return false;
+    std::memcpy(&value, in.data(), sizeof(value));
+    in.remove_prefix(sizeof(value));
+    return true;
+  }
+
+  bool getString(std::string_view &in, std::string &s)
+  {
+    uint32_t size;
+    if (!get(in, size) || in.size() < size)
+      return false;
+    s.assign(in.data(), size);
+    in.remove_prefix(size);
+    return true;
+  }
+
+  bool getStrings(std::string_view &in, std::vector<std::string> &strings)
+  {
+    uint32_t count;
+    if (!get(in, count) || count > in.size())
+      return false;
+    strings.resize(count);
+    for (auto &s : strings)
+    {
+      if (!getString(in, s))
+        return false;
+    }
+    return true;
+  }
+
+  bool readFile(const std::string &path, std::string &out)
+  {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs)
+      return false;
+
+    std::ostringstream ss;
+    ss << ifs.rdbuf();
+    out = ss.str();
+    return !ifs.bad();
+  }
+
+  // The *.syntax files of each directory in name order, directories in the
+  // order given.
+  std::vector<Source> listSources(const std::vector<std::string> &dirs)
+  {
+    std::vector<Source> sources;
+    for (const auto &dir : dirs)
+    {
+      std::error_code ec;
+      std::vector<std::string> paths;
+      for (std::filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+      {
+        if (it->path().extension() == ".syntax")
+          paths.push_back(it->path().string());
+      }
+      std::sort(paths.begin(), paths.end());
+
+      for (auto &path : paths)
+      {
+        struct stat st;
+        if (stat(path.c_str(), &st) == -1 || !S_ISREG(st.st_mode))
+          continue;
+
+        const int64_t mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        sources.push_back({std::move(path), mtime_ns, static_cast<uint64_t>(st.st_size)});
+      }
+    }
+    return sources;
+  }
+
+  void saveSyntax(std::string &out, const EditorSyntax &syntax)
+  {
+    putString(out, syntax.filetype);
+    putStrings(out, syntax.filematch);
+    putStrings(out, syntax.keywords);
+    putString(out, syntax.singleline_comment_start);
+    putString(out, syntax.multiline_comment_start);
+    putString(out, syntax.multiline_comment_end);
+    put(out, syntax.flags);
+    syntax.keyword_table.save(out);
+  }
+
+  bool loadSyntax(std::string_view &in, EditorSyntax &syntax)
+  {
+    if (!getString(in, syntax.filetype) || !getStrings(in, syntax.filematch) ||
+        !getStrings(in, syntax.keywords) || !getString(in, syntax.singleline_comment_start) ||
+        !getString(in, syntax.multiline_comment_start) || !getString(in, syntax.multiline_comment_end) ||
+        !get(in, syntax.flags) || !syntax.keyword_table.load(in))
+      return false;
+
+    // findSyntax() tells extensions from names by the first character
+    return std::none_of(syntax.filematch.begin(), syntax.filematch.end(), [](const std::string &fm)
+                        { return fm.empty(); });
+  }
+
+  // Reads the compiled definitions from the cache if it was built from
+  // exactly `sources`.
+  bool readCache(const std::string &cache_path, const std::vector<Source> &sources,
+                 std::vector<std::shared_ptr<const EditorSyntax>> &syntaxes)
+  {
+    std::string data;
+    if (cache_path.empty() || !readFile(cache_path, data) ||
+        data.size() < sizeof(MAGIC) || std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0)
+      return false;
+
+    std::string_view in(data);
+    in.remove_prefix(sizeof(MAGIC));
+
+    uint32_t count;
+    if (!get(in, count) || count != sources.size())
+      return false;
+    for (const auto &source : sources)
+    {
+      Source cached;
+      if (!getString(in, cached.path) || !get(in, cached.mtime_ns) || !get(in, cached.size) ||
+          !(cached == source))
+        return false;
+    }
+
+    if (!get(in, count) || count > in.size())
+      return false;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      auto syntax = std::make_shared<EditorSyntax>();
+      if (!loadSyntax(in, *syntax))
+        return false;
+      syntaxes.push_back(std::move(syntax));
+    }
+
+    return in.empty();
+  }
+
+  void writeCache(const std::string &cache_path, const std::vector<Source> &sources,
+                  const std::vector<std::shared_ptr<const EditorSyntax>> &syntaxes)
+  {
+    std::string data(MAGIC, sizeof(MAGIC));
+    put(data, static_cast<uint32_t>(sources.size()));
+    for (const auto &source : sources)
+    {
+      putString(data, source.path);
+      put(data, source.mtime_ns);
+      put(data, source.size);
+    }
+    put(data, static_cast<uint32_t>(syntaxes.size()));
+    for (const auto &syntax : syntaxes)
+      saveSyntax(data, *syntax);
+
+    // a cache that cannot be written only costs the next start its parsing
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(cache_path).parent_path(), ec);
+    AtomicFile file(cache_path);
+    if (file.open() && file.append(data))
+      file.commit();
+  }
+}
+
+bool parseSyntax(std::string_view text, EditorSyntax &syntax, std::string &error)
+{
+  syntax = EditorSyntax();
+
+  int lineno = 0;
+  while (!text.empty())
+  {
+    const auto eol = std::min(text.find('\n'), text.size());
+    const auto line = text.substr(0, eol);
+    text.remove_prefix(std::min(eol + 1, text.size()));
+    lineno++;
+
+    std::vector<std::string> words;
+    std::istringstream ss{std::string(line)};
+    for (std::string word; ss >> word;)
+      words.push_back(std::move(word));
+
+    if (words.empty() || words[0][0] == '#')
+      continue;
+
+    const auto key = words[0];
+    words.erase(words.begin());
+
+    const auto fail = [&](const std::string &msg)
+    {
+      error = "line " + std::to_string(lineno) + ": " + msg;
+      return false;
+    };
+
+    if (key == "filetype")
+    {
+      if (words.size() != 1)
+        return fail("filetype takes one name");
+      syntax.filetype = words[0];
+    }
+    else if (key == "filematch")
+    {
+      syntax.filematch.insert(syntax.filematch.end(), words.begin(), words.end());
+    }
+    else if (key == "keywords" || key == "keywords2")
+    {
+      for (auto &word : words)
+      {
+        // rows are split into words at separators, so such a keyword is
+        // never looked up
+        if (std::any_of(word.begin(), word.end(), [](char c)
+                        { return isSeparator(static_cast<unsigned char>(c)); }))
+          return fail("keyword '" + word + "' contains a separator");
+        if (key == "keywords2")
+          word += '|';
+        syntax.keywords.push_back(std::move(word));
+      }
+    }
+    else if (key == "comment")
+    {
+      if (words.size() != 1)
+        return fail("comment takes one delimiter");
+      syntax.singleline_comment_start = words[0];
+    }
+    else if (key == "multiline_comment")
+    {
+      if (words.size() != 2)
+        return fail("multiline_comment takes a start and an end delimiter");
+      syntax.multiline_comment_start = words[0];
+      syntax.multiline_comment_end = words[1];
+    }
+    else if (key == "highlight")
+    {
+      for (const auto &word : words)
+      {
+        if (word == "numbers")
+          syntax.flags |= HL_HIGHLIGHT_NUMBERS;
+        else if (word == "strings")
+          syntax.flags |= HL_HIGHLIGHT_STRINGS;
+        else
+          return fail("unknown highlight '" + word + "'");
+      }
+    }
+    else
+    {
+      return fail("unknown key '" + key + "'");
+    }
+  }
+
+  if (syntax.filetype.empty())
+  {
+    error = "no filetype";
+    return false;
+  }
+  if (syntax.filematch.empty())
+  {
+    error = "no filematch";
+    return false;
+  }
+  return true;
+}
+
+std::vector<std::string> loadSyntaxFiles(const std::vector<std::string> &dirs, const std::string &cache_path)
+{
+  const auto sources = listSources(dirs);
+  std::vector<std::string> errors;
+  std::vector<std::shared_ptr<const EditorSyntax>> syntaxes;
+
+  if (!readCache(cache_path, sources, syntaxes))
+  {
+    syntaxes.clear();
+    for (const auto &source : sources)
+    {
+      std::string text;
+      if (!readFile(source.path, text))
+      {
+        errors.push_back(source.path + ": " + std::strerror(errno));
+        continue;
+      }
+
+      auto syntax = std::make_shared<EditorSyntax>();
+      std::string error;
+      if (!parseSyntax(text, *syntax, error))
+      {
+        errors.push_back(source.path + ": " + error);
+        continue;
+      }
+      compileSyntax(*syntax);
+      syntaxes.push_back(std::move(syntax));
+    }
+
+    // a broken file is parsed again next time, so its error is reported
+    // until it is fixed
+    if (errors.empty() && !cache_path.empty())
+      writeCache(cache_path, sources, syntaxes);
+  }
+
+  for (auto &syntax : syntaxes)
+    registerSyntax(std::move(syntax));
+  return errors;
+}
+
+std::vector<std::string> syntaxDirectories()
+{
+  std::vector<std::string> dirs = {KILO_SYNTAX_DIR};
+
+  const char *config = std::getenv("XDG_CONFIG_HOME");
+  const char *home = std::getenv("HOME");
+  if (config && *config)
+    dirs.push_back(std::string(config) + "/kilo++/syntax");
+  else if (home && *home)
+    dirs.push_back(std::string(home) + "/.config/kilo++/syntax");
+
+  return dirs;
+}
+
+std::string syntaxCachePath()
+{
+  const char *cache = std::getenv("XDG_CACHE_HOME");
+  const char *home = std::getenv("HOME");
+  if (cache && *cache)
+    return std::string(cache) + "/kilo++/syntax.cache";
+  if (home && *home)
+    return std::string(home) + "/.cache/kilo++/syntax.cache";
+  return "";
+}
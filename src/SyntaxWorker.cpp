@@ -0,0 +1,104 @@
+#include "kilo++/SyntaxWorker.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+SyntaxWorker::SyntaxWorker()
+{
+  if (pipe(m_pipe) == 0)
+  {
+    fcntl(m_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(m_pipe[1], F_SETFL, O_NONBLOCK);
+  }
+
+  m_thread = std::thread(&SyntaxWorker::loop, this);
+}
+
+SyntaxWorker::~SyntaxWorker()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cond.notify_one();
+  m_thread.join();
+
+  close(m_pipe[0]);
+  close(m_pipe[1]);
+}
+
+void SyntaxWorker::submit(HighlightJob job)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_job = std::make_unique<HighlightJob>(std::move(job));
+  }
+  m_cond.notify_one();
+}
+
+bool SyntaxWorker::take(HighlightResult &result)
+{
+  char drain[64];
+  while (read(m_pipe[0], drain, sizeof(drain)) > 0)
+    ;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_result)
+    return false;
+
+  result = std::move(*m_result);
+  m_result.reset();
+  return true;
+}
+
+bool SyntaxWorker::busy()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_job || m_running;
+}
+
+int SyntaxWorker::notifyFd() const
+{
+  return m_pipe[0];
+}
+
+void SyntaxWorker::loop()
+{
+  while (true)
+  {
+    std::unique_ptr<HighlightJob> job;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cond.wait(lock, [this]
+                  { return m_stop || m_job; });
+      if (m_stop)
+        return;
+
+      job = std::move(m_job);
+      m_running = true;
+    }
+
+    auto result = std::make_unique<HighlightResult>();
+    result->version = job->version;
+    result->first_row = job->first_row;
+    result->in_comment = job->in_comment;
+    result->hl.resize(job->text.size());
+    result->open_comment.resize(job->text.size());
+
+    bool in_comment = job->in_comment;
+    for (std::size_t i = 0; i < job->text.size(); ++i)
+    {
+      in_comment = highlightRow(*job->syntax, job->text[i], in_comment, result->hl[i]);
+      result->open_comment[i] = in_comment;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_result = std::move(result);
+      m_running = false;
+    }
+
+    const char wake = 1;
+    (void)!write(m_pipe[1], &wake, 1);
+  }
+}
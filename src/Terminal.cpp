@@ -0,0 +1,166 @@
+#include "kilo++/Terminal.hpp"
+#include "kilo++/EditorUtils.hpp"
+
+#include <cerrno>
+#include <stdexcept>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+/*** tty terminal ***/
+
+TtyTerminal::TtyTerminal()
+{
+  terminal_manager::enableRawMode();
+  terminal_manager::resizeFd();
+}
+
+TtyTerminal::~TtyTerminal()
+{
+  write("\x1b[2J\x1b[H");
+  terminal_manager::disableRawMode();
+}
+
+bool TtyTerminal::getWindowSize(int &rows, int &cols)
+{
+  return terminal_manager::getWindowSize(&rows, &cols) != -1;
+}
+
+void TtyTerminal::write(std::string_view bytes)
+{
+  while (!bytes.empty())
+  {
+    const ssize_t written = ::write(STDOUT_FILENO, bytes.data(), bytes.size());
+    if (written == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      // the screen is repainted in full once it can be written again
+      return;
+    }
+    bytes.remove_prefix(written);
+  }
+}
+
+int TtyTerminal::readKey()
+{
+  return terminal_manager::readKey();
+}
+
+bool TtyTerminal::inputPending()
+{
+  return terminal_manager::inputPending();
+}
+
+const std::string &TtyTerminal::pastedText()
+{
+  return terminal_manager::pastedText();
+}
+
+int TtyTerminal::inputFd()
+{
+  return STDIN_FILENO;
+}
+
+int TtyTerminal::resizeFd()
+{
+  return terminal_manager::resizeFd();
+}
+
+bool TtyTerminal::takeResize()
+{
+  return terminal_manager::takeResize();
+}
+
+/*** headless terminal ***/
+
+HeadlessTerminal::HeadlessTerminal(int rows, int cols)
+    : m_rows(rows), m_cols(cols)
+{
+}
+
+void HeadlessTerminal::pushKey(int key)
+{
+  m_keys.push_back(key);
+}
+
+void HeadlessTerminal::pushText(std::string_view text)
+{
+  // bytes come out as readKey() on a terminal returns them
+  for (const char c : text)
+    m_keys.push_back(c);
+}
+
+void HeadlessTerminal::pushInput(std::string_view input)
+{
+  std::vector<int> keys;
+  std::vector<std::string> pastes;
+  terminal_manager::decodeInput(input, keys, pastes);
+
+  m_keys.insert(m_keys.end(), keys.begin(), keys.end());
+  for (auto &paste : pastes)
+    m_pastes.push_back(std::move(paste));
+}
+
+void HeadlessTerminal::pushPaste(std::string text)
+{
+  m_keys.push_back(static_cast<int>(EditorKey::PASTE));
+  m_pastes.push_back(std::move(text));
+}
+
+std::size_t HeadlessTerminal::bytesWritten() const
+{
+  return m_bytes_written;
+}
+
+bool HeadlessTerminal::getWindowSize(int &rows, int &cols)
+{
+  rows = m_rows;
+  cols = m_cols;
+  return true;
+}
+
+void HeadlessTerminal::write(std::string_view bytes)
+{
+  m_bytes_written += bytes.size();
+}
+
+int HeadlessTerminal::readKey()
+{
+  if (m_keys.empty())
+    throw std::runtime_error("no more input");
+
+  const int key = m_keys.front();
+  m_keys.pop_front();
+  if (key == static_cast<int>(EditorKey::PASTE))
+  {
+    m_paste = std::move(m_pastes.front());
+    m_pastes.pop_front();
+  }
+  return key;
+}
+
+bool HeadlessTerminal::inputPending()
+{
+  return !m_keys.empty();
+}
+
+const std::string &HeadlessTerminal::pastedText()
+{
+  return m_paste;
+}
+
+int HeadlessTerminal::inputFd()
+{
+  return -1;
+}
+
+int HeadlessTerminal::resizeFd()
+{
+  return -1;
+}
+
+bool HeadlessTerminal::takeResize()
+{
+  return false;
+}
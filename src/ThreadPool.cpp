@@ -0,0 +1,112 @@
+#include "kilo++/ThreadPool.hpp"
+
+#include <algorithm>
+
+namespace
+{
+  thread_local bool in_pool_task = false;
+}
+
+ThreadPool &ThreadPool::shared()
+{
+  static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+  return pool;
+}
+
+ThreadPool::ThreadPool(unsigned threads)
+{
+  for (unsigned i = 1; i < threads; ++i)
+    m_workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_work_cond.notify_all();
+
+  for (auto &worker : m_workers)
+    worker.join();
+}
+
+unsigned ThreadPool::concurrency() const
+{
+  return static_cast<unsigned>(m_workers.size()) + 1;
+}
+
+void ThreadPool::parallelFor(std::size_t count, std::size_t grain, const RangeFn &fn)
+{
+  if (count == 0)
+    return;
+
+  grain = std::max<std::size_t>(grain, 1);
+
+  // small loops and nested calls are not worth waking anybody for
+  if (m_workers.empty() || count <= grain || in_pool_task)
+  {
+    fn(0, count);
+    return;
+  }
+
+  std::lock_guard<std::mutex> batch(m_batch_mutex);
+
+  // a few chunks per thread so uneven chunks still balance out
+  const std::size_t target_chunks = static_cast<std::size_t>(concurrency()) * 4;
+  const std::size_t chunk = std::max(grain, (count + target_chunks - 1) / target_chunks);
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_fn = &fn;
+    m_count = count;
+    m_chunk = chunk;
+    m_next = 0;
+    m_pending = m_workers.size();
+    m_generation++;
+  }
+  m_work_cond.notify_all();
+
+  runChunks();
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_done_cond.wait(lock, [this]
+                   { return m_pending == 0; });
+  m_fn = nullptr;
+}
+
+void ThreadPool::workerLoop()
+{
+  uint64_t seen = 0;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_work_cond.wait(lock, [&]
+                       { return m_stop || m_generation != seen; });
+      if (m_stop)
+        return;
+      seen = m_generation;
+    }
+
+    runChunks();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (--m_pending == 0)
+      m_done_cond.notify_one();
+  }
+}
+
+void ThreadPool::runChunks()
+{
+  in_pool_task = true;
+  while (true)
+  {
+    const std::size_t begin = m_next.fetch_add(m_chunk);
+    if (begin >= m_count)
+      break;
+
+    (*m_fn)(begin, std::min(begin + m_chunk, m_count));
+  }
+  in_pool_task = false;
+}
@@ -0,0 +1,188 @@
+#include "kilo++/UndoLog.hpp"
+
+#include <limits>
+
+// longest pause between keys that still continues a group
+#define KILO_UNDO_COALESCE_MS 1000
+
+namespace
+{
+  constexpr uint64_t UNREACHABLE = std::numeric_limits<uint64_t>::max();
+}
+
+UndoLog::UndoLog(std::size_t memory_limit)
+    : m_limit(memory_limit)
+{
+}
+
+void UndoLog::begin(Kind kind, Cursor cursor)
+{
+  const auto now = std::chrono::steady_clock::now();
+
+  // a new edit after undoing discards what could have been redone
+  while (m_groups.size() > m_applied)
+  {
+    if (m_groups.back().id == m_saved_id)
+      m_saved_id = UNREACHABLE;
+    m_bytes -= m_groups.back().bytes;
+    m_groups.pop_back();
+  }
+
+  if (!m_groups.empty())
+  {
+    auto &last = m_groups.back();
+    if (!last.sealed && kind != Kind::OTHER && last.kind == kind && last.after == cursor &&
+        now - last.last < std::chrono::milliseconds(KILO_UNDO_COALESCE_MS))
+    {
+      last.last = now;
+      m_open = true;
+      return;
+    }
+    last.sealed = true;
+  }
+
+  Group group;
+  group.id = m_next_id++;
+  group.kind = kind;
+  group.before = cursor;
+  group.after = cursor;
+  group.last = now;
+  m_groups.push_back(std::move(group));
+  m_applied = m_groups.size();
+  m_open = true;
+}
+
+void UndoLog::record(Op op, int row, int col, std::string_view text)
+{
+  if (!m_open)
+    return;
+
+  auto &group = m_groups.back();
+
+  // typing and forward deletes extend the edit before them
+  if (!group.edits.empty())
+  {
+    auto &prev = group.edits.back();
+    const bool at_text_end = prev.offset + prev.length == group.text.size();
+    if (at_text_end && prev.op == op && prev.row == row &&
+        ((op == Op::INSERT_CHARS && col == prev.col + static_cast<int>(prev.length)) ||
+         (op == Op::DELETE_CHARS && col == prev.col)))
+    {
+      group.text += text;
+      prev.length += static_cast<uint32_t>(text.size());
+      return;
+    }
+  }
+
+  group.edits.push_back({op, row, col, static_cast<uint32_t>(group.text.size()), static_cast<uint32_t>(text.size())});
+  group.text += text;
+}
+
+void UndoLog::end(Cursor cursor)
+{
+  if (!m_open)
+    return;
+  m_open = false;
+
+  auto &group = m_groups.back();
+  if (group.edits.empty())
+  {
+    m_bytes -= group.bytes;
+    m_groups.pop_back();
+    m_applied = m_groups.size();
+    return;
+  }
+
+  group.after = cursor;
+
+  m_bytes -= group.bytes;
+  group.bytes = sizeof(Group) + group.edits.capacity() * sizeof(Edit) + group.text.capacity();
+  m_bytes += group.bytes;
+
+  trim();
+}
+
+void UndoLog::seal()
+{
+  if (!m_groups.empty())
+    m_groups.back().sealed = true;
+}
+
+void UndoLog::clear()
+{
+  m_groups.clear();
+  m_applied = 0;
+  m_open = false;
+  m_dropped_id = 0;
+  m_saved_id = 0;
+  m_bytes = 0;
+}
+
+void UndoLog::markSaved()
+{
+  seal();
+  m_saved_id = position();
+}
+
+bool UndoLog::atSavedPoint() const
+{
+  return position() == m_saved_id;
+}
+
+void UndoLog::forgetSavedPoint()
+{
+  m_saved_id = UNREACHABLE;
+}
+
+std::size_t UndoLog::memoryUsage() const
+{
+  return m_bytes;
+}
+
+void UndoLog::setMemoryLimit(std::size_t limit)
+{
+  m_limit = limit;
+  trim();
+}
+
+UndoLog::Op UndoLog::inverse(Op op)
+{
+  switch (op)
+  {
+  case Op::INSERT_CHARS:
+    return Op::DELETE_CHARS;
+  case Op::DELETE_CHARS:
+    return Op::INSERT_CHARS;
+  case Op::INSERT_ROW:
+    return Op::DELETE_ROW;
+  case Op::DELETE_ROW:
+    return Op::INSERT_ROW;
+  case Op::SPLIT_ROW:
+    return Op::JOIN_ROWS;
+  case Op::JOIN_ROWS:
+    return Op::SPLIT_ROW;
+  }
+
+  return op;
+}
+
+// The state after a group is the state before the next one, so once the
+// groups up to the saved one have been dropped, undoing everything left
+// still gets back to it.
+uint64_t UndoLog::position() const
+{
+  return m_applied ? m_groups[m_applied - 1].id : m_dropped_id;
+}
+
+// Drops the oldest groups until the log fits its limit again. The newest
+// group always stays, however big it is.
+void UndoLog::trim()
+{
+  while (m_bytes > m_limit && m_groups.size() > 1 && m_applied > 1)
+  {
+    m_bytes -= m_groups.front().bytes;
+    m_dropped_id = m_groups.front().id;
+    m_groups.pop_front();
+    m_applied--;
+  }
+}
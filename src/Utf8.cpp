@@ -0,0 +1,238 @@
+#include "kilo++/Utf8.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KILO_UTF8_X86 1
+#endif
+
+namespace
+{
+  struct Range
+  {
+    char32_t first, last;
+  };
+
+  // sorted, so a code point is looked up by binary search
+  constexpr Range ZERO_WIDTH[] = {
+      {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF}, {0x05C1, 0x05C2},
+      {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A}, {0x064B, 0x065F}, {0x0670, 0x0670},
+      {0x06D6, 0x06DC}, {0x06DF, 0x06E4}, {0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0711, 0x0711},
+      {0x0730, 0x074A}, {0x0900, 0x0902}, {0x093A, 0x093A}, {0x093C, 0x093C}, {0x0941, 0x0948},
+      {0x094D, 0x094D}, {0x0951, 0x0957}, {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E},
+      {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x202A, 0x202E}, {0x2060, 0x2064},
+      {0x20D0, 0x20FF}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0x1F3FB, 0x1F3FF},
+      {0xE0000, 0xE007F}, {0xE0100, 0xE01EF},
+  };
+
+  constexpr Range WIDE[] = {
+      {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC}, {0x23F0, 0x23F0},
+      {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267F, 0x267F},
+      {0x2693, 0x2693}, {0x26A1, 0x26A1}, {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5},
+      {0x26CE, 0x26CE}, {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+      {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B}, {0x2728, 0x2728},
+      {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797},
+      {0x27B0, 0x27B0}, {0x27BF, 0x27BF}, {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55},
+      {0x2E80, 0x303E}, {0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+      {0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6F},
+      {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4}, {0x17000, 0x18AFF}, {0x1B000, 0x1B2FF},
+      {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F202},
+      {0x1F210, 0x1F23B}, {0x1F240, 0x1F248}, {0x1F250, 0x1F251}, {0x1F300, 0x1F64F}, {0x1F680, 0x1F6FF},
+      {0x1F7E0, 0x1F7EB}, {0x1F900, 0x1F9FF}, {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+  };
+
+  constexpr char32_t ZERO_WIDTH_JOINER = 0x200D;
+
+  template <std::size_t N>
+  bool inRanges(const Range (&ranges)[N], char32_t cp)
+  {
+    const auto it = std::upper_bound(std::begin(ranges), std::end(ranges), cp, [](char32_t c, const Range &r)
+                                     { return c < r.first; });
+    return it != std::begin(ranges) && cp <= std::prev(it)->last;
+  }
+
+  bool isControl(char32_t cp)
+  {
+    return cp < 0x20 || (cp >= 0x7F && cp < 0xA0);
+  }
+
+  // Start of the code point covering byte `at`; a byte that is not part of
+  // a valid sequence stands on its own.
+  std::size_t codepointStart(std::string_view s, std::size_t at)
+  {
+    std::size_t p = at;
+    while (p > 0 && at - p < 3 && (static_cast<unsigned char>(s[p]) & 0xC0) == 0x80)
+      p--;
+
+    char32_t cp;
+    const auto length = utf8::decode(s, p, cp);
+    return length && p + length > at ? p : at;
+  }
+
+  bool joinsPrevious(std::string_view s, std::size_t at)
+  {
+    char32_t cp;
+    return utf8::decode(s, at, cp) && cp >= 0x300 && utf8::width(cp) == 0;
+  }
+
+  bool isJoiner(std::string_view s, std::size_t at)
+  {
+    char32_t cp;
+    return utf8::decode(s, at, cp) && cp == ZERO_WIDTH_JOINER;
+  }
+
+  bool isAsciiScalar(const unsigned char *p, std::size_t n)
+  {
+    // eight bytes at a time, then the tail
+    uint64_t bits = 0;
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+      uint64_t word;
+      std::memcpy(&word, p + i, 8);
+      bits |= word;
+    }
+    for (; i < n; ++i)
+      bits |= p[i];
+    return (bits & 0x8080808080808080ull) == 0;
+  }
+
+#ifdef KILO_UTF8_X86
+  bool isAsciiSSE2(const unsigned char *p, std::size_t n)
+  {
+    std::size_t i = 0;
+    for (; i + 64 <= n; i += 64)
+    {
+      // the high bits of four blocks are gathered before one test
+      const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+      const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i + 16));
+      const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i + 32));
+      const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i + 48));
+      if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))))
+        return false;
+    }
+    for (; i + 16 <= n; i += 16)
+    {
+      if (_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i))))
+        return false;
+    }
+    return isAsciiScalar(p + i, n - i);
+  }
+#endif
+}
+
+namespace utf8
+{
+  bool isAscii(std::string_view s)
+  {
+    const auto *p = reinterpret_cast<const unsigned char *>(s.data());
+#ifdef KILO_UTF8_X86
+    return isAsciiSSE2(p, s.size());
+#else
+    return isAsciiScalar(p, s.size());
+#endif
+  }
+
+  std::size_t decode(std::string_view s, std::size_t at, char32_t &cp)
+  {
+    const auto byte = [&](std::size_t i)
+    { return static_cast<unsigned char>(s[i]); };
+
+    const unsigned char lead = byte(at);
+    std::size_t length;
+    char32_t min;
+    if (lead < 0x80)
+    {
+      cp = lead;
+      return 1;
+    }
+    else if ((lead & 0xE0) == 0xC0)
+    {
+      length = 2;
+      cp = lead & 0x1F;
+      min = 0x80;
+    }
+    else if ((lead & 0xF0) == 0xE0)
+    {
+      length = 3;
+      cp = lead & 0x0F;
+      min = 0x800;
+    }
+    else if ((lead & 0xF8) == 0xF0)
+    {
+      length = 4;
+      cp = lead & 0x07;
+      min = 0x10000;
+    }
+    else
+    {
+      return 0;
+    }
+
+    if (at + length > s.size())
+      return 0;
+    for (std::size_t i = 1; i < length; ++i)
+    {
+      if ((byte(at + i) & 0xC0) != 0x80)
+        return 0;
+      cp = (cp << 6) | (byte(at + i) & 0x3F);
+    }
+
+    // overlong forms, surrogates and values past the last plane
+    if (cp < min || (cp >= 0xD800 && cp < 0xE000) || cp > 0x10FFFF)
+      return 0;
+    return length;
+  }
+
+  int width(char32_t cp)
+  {
+    if (cp < 0x300)
+      return 1;
+    if (inRanges(ZERO_WIDTH, cp))
+      return 0;
+    return inRanges(WIDE, cp) ? 2 : 1;
+  }
+
+  Cluster cluster(std::string_view s, std::size_t at)
+  {
+    char32_t cp;
+    const auto length = decode(s, at, cp);
+    Cluster c = {at + 1, 1, false};
+    bool joined = false;
+    if (length)
+    {
+      // a zero-width character with nothing to sit on is shown on its own
+      const int w = width(cp);
+      c = {at + length, w ? w : 1, w && !isControl(cp)};
+      joined = cp == ZERO_WIDTH_JOINER;
+    }
+
+    while (c.end < s.size())
+    {
+      const auto next = decode(s, c.end, cp);
+      if (!next || (!joined && (cp < 0x300 || width(cp) != 0)))
+        break;
+
+      joined = cp == ZERO_WIDTH_JOINER;
+      c.end += next;
+    }
+    return c;
+  }
+
+  std::size_t clusterStart(std::string_view s, std::size_t at)
+  {
+    auto p = codepointStart(s, at);
+    while (p > 0)
+    {
+      const auto prev = codepointStart(s, p - 1);
+      if (!joinsPrevious(s, p) && !isJoiner(s, prev))
+        break;
+      p = prev;
+    }
+    return p;
+  }
+}
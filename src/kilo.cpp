@@ -1,8 +1,44 @@
+#include "kilo++/Batch.hpp"
 #include "kilo++/Editor.hpp"
 
+#include <exception>
+#include <iostream>
+#include <string_view>
+
 int main(int argc, char **argv)
 {
-  Editor editor;
-  editor.run(argc, argv);
+  try
+  {
+    if (argc > 1 && std::string_view(argv[1]) == "--script")
+    {
+      if (argc < 4)
+      {
+        std::cerr << "usage: " << argv[0] << " --script SCRIPT FILE..." << std::endl;
+        return 2;
+      }
+      return runBatch(argv[2], std::vector<std::string>(argv + 3, argv + argc), std::cerr) ? 1 : 0;
+    }
+
+    if (argc > 1 && (std::string_view(argv[1]) == "--view" || std::string_view(argv[1]) == "--follow"))
+    {
+      if (argc != 3)
+      {
+        std::cerr << "usage: " << argv[0] << " " << argv[1] << " FILE" << std::endl;
+        return 2;
+      }
+      Editor editor;
+      editor.view(argv[2], std::string_view(argv[1]) == "--follow");
+      return 0;
+    }
+
+    Editor editor;
+    editor.run(argc, argv);
+  }
+  catch (const std::exception &e)
+  {
+    // the editor has restored the terminal by now
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
   return 0;
 }